@@ -0,0 +1,64 @@
+#include "admission.h"
+#include <sys/uio.h>
+#include "http.h"
+#include "json.hpp"
+#include "metrics.h"
+
+using json = nlohmann::json;
+
+AdmissionControl::AdmissionControl(const ServerConfig& config)
+    : highWatermark(config.connectionsHighWatermark), lowWatermark(config.connectionsLowWatermark) {
+    if (lowWatermark <= 0 || lowWatermark > highWatermark) {
+        lowWatermark = highWatermark - highWatermark / 10;
+    }
+
+    //   rendered once, so shedding costs one write and no allocation however hard the server is pushed
+    json body;
+    body["error"] = "Service Unavailable";
+    HttpResponse response = buildHttpResponse(503, "Service Unavailable", body.dump());
+    response.head += "Retry-After: " + to_string(config.retryAfter) + "\r\n";
+
+    struct iovec iov[HTTP_RESPONSE_SEGMENTS];
+    response.segments(iov, false);
+    for (auto& segment : iov) {
+        overload.append((const char*)segment.iov_base, segment.iov_len);
+    }
+}
+
+//   checker for a freshly accepted connection, counts it as open when it is admitted
+bool AdmissionControl::admit() {
+    ServerMetrics& metrics = serverMetrics();
+
+    //   the slot is taken before the check and handed back if the connection is shed, so workers admitting at
+    //   the same time each count the others and never overshoot the high watermark together
+    int64_t open = metrics.connectionsOpen.fetch_add(1, memory_order_relaxed);
+
+    //   hysteresis: once shedding starts it continues until enough connections have closed
+    if (highWatermark > 0) {
+        bool shed;
+        if (shedding.load(memory_order_relaxed)) {
+            shed = open >= lowWatermark;
+            if (!shed) {
+                shedding.store(false, memory_order_relaxed);
+            }
+        } else {
+            shed = open >= highWatermark;
+            if (shed) {
+                shedding.store(true, memory_order_relaxed);
+            }
+        }
+        if (shed) {
+            metrics.connectionsOpen.fetch_sub(1, memory_order_relaxed);
+            countMetric(metrics.connectionsShed);
+            return false;
+        }
+    }
+
+    countMetric(metrics.connectionsAccepted);
+    return true;
+}
+
+//   releaser for an admitted connection that was closed
+void AdmissionControl::release() {
+    serverMetrics().connectionsOpen.fetch_sub(1, memory_order_relaxed);
+}
@@ -0,0 +1,34 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include "config.h"
+
+using namespace std;
+
+//   admission control section - bounds the connections all workers hold open at once; past the high
+//   watermark new connections are shed with a pre-rendered 503 until the count falls to the low watermark
+
+class AdmissionControl {
+public:
+    explicit AdmissionControl(const ServerConfig& config);
+
+    // checker for a freshly accepted connection, counts it as open when it is admitted
+    bool admit();
+
+    // releaser for an admitted connection that was closed
+    void release();
+
+    // complete 503 response (with Retry-After and Connection: close) written to shed connections
+    string_view overloadResponse() const { return overload; }
+
+private:
+    int highWatermark;      // 0 = admission control disabled
+    int lowWatermark;
+    atomic<bool> shedding{false};
+    string overload;
+};
+
+#endif // ADMISSION_H
@@ -0,0 +1,45 @@
+#include "compactor.h"
+
+//   how often the triggers are checked; the size trigger can overshoot by what is logged in this time
+static const chrono::seconds CHECK_INTERVAL(1);
+
+Compactor::Compactor(DataStore& store, const ServerConfig& config)
+    : store(store),
+      walCompactBytes(config.walCompactBytes > 0 ? config.walCompactBytes : 0),
+      interval(config.snapshotInterval > 0 ? config.snapshotInterval : 0) {
+    if (walCompactBytes > 0 || interval.count() > 0) {
+        worker = thread(&Compactor::run, this);
+    }
+}
+
+Compactor::~Compactor() {
+    {
+        lock_guard<mutex> lock(stateLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+//   loop checking the triggers until the compactor is destroyed
+void Compactor::run() {
+    auto lastSnapshot = chrono::steady_clock::now();
+    unique_lock<mutex> lock(stateLock);
+    while (!wake.wait_for(lock, CHECK_INTERVAL, [this] { return stopping; })) {
+        uint64_t logged = store.logBytes();
+        if (logged == 0) continue;
+
+        auto now = chrono::steady_clock::now();
+        bool bySize = walCompactBytes > 0 && logged >= walCompactBytes;
+        bool byTime = interval.count() > 0 && now - lastSnapshot >= interval;
+        if (!bySize && !byTime) continue;
+
+        //   the snapshot runs without stateLock, so destruction only waits for the one in progress
+        lock.unlock();
+        store.saveData();
+        lastSnapshot = chrono::steady_clock::now();
+        lock.lock();
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef COMPACTOR_H
+#define COMPACTOR_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "datastore.h"
+#include "config.h"
+
+using namespace std;
+
+//   compactor section - background thread that snapshots the DataStore once its write-ahead log grows past
+//   WAL_COMPACT_BYTES or SNAPSHOT_INTERVAL has passed with changes, so startup replay and disk use stay bounded
+
+class Compactor {
+public:
+    Compactor(DataStore& store, const ServerConfig& config);
+    ~Compactor();
+    Compactor(const Compactor&) = delete;
+    Compactor& operator=(const Compactor&) = delete;
+
+private:
+    // loop checking the triggers until the compactor is destroyed
+    void run();
+
+    DataStore& store;
+    uint64_t walCompactBytes;       // 0 = size trigger off
+    chrono::seconds interval;       // 0 = time trigger off
+    mutex stateLock;
+    condition_variable wake;
+    bool stopping = false;
+    thread worker;
+};
+
+#endif // COMPACTOR_H
@@ -0,0 +1,55 @@
+#include "config.h"
+#include <cstdlib>
+#include <thread>
+
+//   reader for an integer environment variable with a default
+static int envInt(const char* name, int fallback) {
+    const char* value = getenv(name);
+    if (value == nullptr || *value == '\0') {
+        return fallback;
+    }
+    char* end = nullptr;
+    long parsed = strtol(value, &end, 10);
+    return (end != value && *end == '\0') ? (int)parsed : fallback;
+}
+
+//   reader for a string environment variable with a default
+static string envString(const char* name, const string& fallback) {
+    const char* value = getenv(name);
+    return (value == nullptr || *value == '\0') ? fallback : string(value);
+}
+
+//   loader for configuration from the environment, falling back to defaults
+ServerConfig loadServerConfig() {
+    ServerConfig config;
+    config.port = envInt("PORT", config.port);
+    config.workers = envInt("WORKERS", config.workers);
+    config.keepAliveTimeout = envInt("KEEPALIVE_TIMEOUT", config.keepAliveTimeout);
+    config.headerTimeout = envInt("HEADER_TIMEOUT", config.headerTimeout);
+    config.bodyTimeout = envInt("BODY_TIMEOUT", config.bodyTimeout);
+    config.writeTimeout = envInt("WRITE_TIMEOUT", config.writeTimeout);
+    config.maxRequestsPerConnection = envInt("MAX_REQUESTS_PER_CONNECTION", config.maxRequestsPerConnection);
+    config.maxBodyBytes = envInt("MAX_BODY_BYTES", config.maxBodyBytes);
+    config.listenBacklog = envInt("LISTEN_BACKLOG", config.listenBacklog);
+    config.connectionsHighWatermark = envInt("CONNECTIONS_HIGH_WATERMARK", config.connectionsHighWatermark);
+    config.connectionsLowWatermark = envInt("CONNECTIONS_LOW_WATERMARK", config.connectionsLowWatermark);
+    config.retryAfter = envInt("RETRY_AFTER", config.retryAfter);
+    config.ioBackend = envString("IO_BACKEND", config.ioBackend);
+    config.walSync = envString("WAL_SYNC", config.walSync);
+    config.groupCommitWindow = envInt("GROUP_COMMIT_WINDOW_US", config.groupCommitWindow);
+    config.groupCommitMax = envInt("GROUP_COMMIT_MAX", config.groupCommitMax);
+    config.durability = envString("DURABILITY", config.durability);
+    config.enrollDurability = envString("ENROLL_DURABILITY", config.enrollDurability);
+    config.walCompactBytes = envInt("WAL_COMPACT_BYTES", config.walCompactBytes);
+    config.snapshotInterval = envInt("SNAPSHOT_INTERVAL", config.snapshotInterval);
+    config.shards = envInt("SHARDS", config.shards);
+
+    if (config.maxBodyBytes < 0) {
+        config.maxBodyBytes = 0;
+    }
+    if (config.workers <= 0) {
+        config.workers = (int)thread::hardware_concurrency();
+        if (config.workers <= 0) config.workers = 1;
+    }
+    return config;
+}
@@ -0,0 +1,36 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+using namespace std;
+
+//   server configuration section - runtime settings read from environment variables
+
+struct ServerConfig {
+    int port = 8080;            // PORT
+    int workers = 0;            // WORKERS, event loop threads (0 = one per core)
+    int keepAliveTimeout = 5;   // KEEPALIVE_TIMEOUT, seconds an idle kept-alive connection stays open
+    int headerTimeout = 10;     // HEADER_TIMEOUT, seconds from a request's first byte (or accept) to its last header
+    int bodyTimeout = 30;       // BODY_TIMEOUT, seconds from the end of the headers to the end of the body
+    int writeTimeout = 30;      // WRITE_TIMEOUT, seconds pending output may go without the client reading any
+    int maxRequestsPerConnection = 100;  // MAX_REQUESTS_PER_CONNECTION, 0 = unlimited
+    int maxBodyBytes = 1 << 20; // MAX_BODY_BYTES, larger request bodies are refused with 413
+    int listenBacklog = 4096;   // LISTEN_BACKLOG, kernel accept queue per worker (capped by net.core.somaxconn)
+    int connectionsHighWatermark = 10000;   // CONNECTIONS_HIGH_WATERMARK, open connections before shedding (0 = off)
+    int connectionsLowWatermark = 0;        // CONNECTIONS_LOW_WATERMARK, resume admitting below this (0 = 90% of high)
+    int retryAfter = 1;         // RETRY_AFTER, seconds suggested to shed clients
+    string ioBackend = "epoll"; // IO_BACKEND, "epoll" or "uring" (falls back to epoll if unsupported)
+    string walSync = "always";  // WAL_SYNC, "always" fsyncs every write-ahead log batch, "none" leaves it to the OS
+    int groupCommitWindow = 0;  // GROUP_COMMIT_WINDOW_US, microseconds a log batch waits for more writers after the first
+    int groupCommitMax = 256;   // GROUP_COMMIT_MAX, records that close a log batch early
+    string durability = "fsync";        // DURABILITY, when mutations are acknowledged: "none", "write" or "fsync"
+    string enrollDurability = "write";  // ENROLL_DURABILITY, the same for enroll/unenroll requests
+    int walCompactBytes = 64 << 20;  // WAL_COMPACT_BYTES, log size that triggers a background snapshot (0 = never)
+    int snapshotInterval = 300; // SNAPSHOT_INTERVAL, seconds after which a changed store is snapshotted (0 = never)
+    int shards = 8;             // SHARDS, partitions of enrollments and grades by student, each with its own writer lock
+};
+
+//   loader for configuration from the environment, falling back to defaults
+ServerConfig loadServerConfig();
+
+#endif // CONFIG_H
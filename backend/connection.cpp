@@ -0,0 +1,255 @@
+#include "connection.h"
+#include <iostream>
+#include <cstdlib>
+#include <climits>
+
+//   pipelined requests stop being processed while this much response data is unsent
+static const size_t MAX_PENDING_OUTPUT = 1 << 20;
+
+Connection::Connection(int fd, int maxRequests, size_t maxBodyBytes)
+    : socketFd(fd), requestsLeft(maxRequests > 0 ? maxRequests : INT_MAX), requestStart(chrono::steady_clock::now()) {
+    parser.setMaxBodySize(maxBodyBytes);
+}
+
+//   appender for freshly received bytes
+void Connection::appendInput(const char* data, size_t length) {
+    //   the header deadline of a new request runs from its first byte, not from the latest one
+    if (inOffset == inBuffer.size() && !awaitingFirstRequest) {
+        requestStart = chrono::steady_clock::now();
+    }
+    inBuffer.append(data, length);
+}
+
+//   processor for every complete request in the input buffer, queues one response per request in order
+void Connection::processInput(DataStore& store) {
+    while (currentState != CLOSING && !closeAfterFlush && pendingOutputSize() < MAX_PENDING_OUTPUT) {
+        string_view pending(inBuffer.data() + inOffset, inBuffer.size() - inOffset);
+        HttpParser::Status status = parser.parse(pending);
+        if (status == HttpParser::NEED_MORE) {
+            //   the body deadline replaces the header deadline once the headers are in
+            if (parser.headersComplete() && !bodyStarted) {
+                bodyStart = chrono::steady_clock::now();
+                bodyStarted = true;
+
+                //   the buffer is sized for the whole message once, instead of growing with every read of the body
+                if (inOffset > 0) {
+                    inBuffer.erase(0, inOffset);
+                    inOffset = 0;
+                }
+                inBuffer.reserve(parser.messageLength());
+
+                //   the body is only sent by such clients once they know it will not be refused
+                if (parser.expectsContinue()) {
+                    queueResponse(buildInterimResponse(100, "Continue"), true);
+                }
+            }
+            break;
+        }
+
+        if (status == HttpParser::ERROR) {
+            json response;
+            response["error"] = parser.errorReason();
+            queueResponse(buildHttpResponse(parser.errorStatus(), parser.errorReason(), response.dump()), false);
+            closeAfterFlush = true;
+            break;
+        }
+
+        //   router for the parsed request, its views point into inBuffer until it is consumed below
+        const HttpRequest& req = parser.request();
+        cout << "Request: " << req.method << " " << req.path << endl;
+        bool keepAlive = wantsKeepAlive(req) && --requestsLeft > 0;
+        HttpResponse response = routeRequest(store, req);
+
+        //   HTTP/1.0 clients cannot decode chunked framing, their streamed body ends with the connection instead
+        if (response.stream && req.version == "HTTP/1.0") {
+            response.sendUntilClose();
+            keepAlive = false;
+        }
+        queueResponse(move(response), keepAlive);
+        if (!keepAlive) {
+            closeAfterFlush = true;
+        }
+
+        inOffset += parser.messageLength();
+        parser.reset();
+        bodyStarted = false;
+        if (inOffset < inBuffer.size()) {
+            requestStart = chrono::steady_clock::now();
+        }
+    }
+
+    //   consumed bytes are dropped in one go rather than per request
+    if (inOffset == inBuffer.size()) {
+        inBuffer.clear();
+        inOffset = 0;
+    } else if (inOffset > 0 && inOffset >= inBuffer.size() / 2) {
+        inBuffer.erase(0, inOffset);
+        inOffset = 0;
+    }
+
+    //   a peer that stopped sending is closed once everything it sent has been answered, and unless output backed
+    //   up before its last request was reached, the answer to that request says so
+    if (peerClosed && pendingOutputSize() < MAX_PENDING_OUTPUT) {
+        closeWithLastResponse();
+    }
+    if (peerClosed && currentState == READING) {
+        currentState = CLOSING;
+    }
+}
+
+//   switcher of the newest queued response to Connection: close, as long as none of its head is on the wire yet
+void Connection::closeWithLastResponse() {
+    closeAfterFlush = true;
+    if (outQueue.empty()) return;
+    PendingResponse& last = outQueue.back();
+    bool started = outQueue.size() == 1 && (outOffset > 0 || last.response.headSent);
+    if (!last.keepAlive || last.response.interim || started) return;
+    queuedBytes -= last.response.wireSize(true);
+    last.keepAlive = false;
+    queuedBytes += last.response.wireSize(false);
+}
+
+//   queuer for one response, its buffers are written as-is without being copied together
+void Connection::queueResponse(HttpResponse response, bool keepAlive) {
+    if (response.stream) {
+        response.advanceStream();
+    }
+    //   the write deadline runs from when output first became pending, then from each bit of progress
+    if (outQueue.empty()) {
+        writeProgress = chrono::steady_clock::now();
+    }
+    awaitingFirstRequest = false;
+    uint64_t& awaited = response.logSynced ? awaitedSyncedSequence : awaitedWrittenSequence;
+    if (response.logSequence > awaited) {
+        awaited = response.logSequence;
+    }
+    queuedBytes += response.wireSize(keepAlive);
+    outQueue.push_back({move(response), keepAlive});
+    currentState = WRITING;
+}
+
+//   replacer for the first held response the broken log will never acknowledge: the responses before it go out,
+//   it becomes a 503 and the connection closes after it, as the requests behind it may have relied on its change
+void Connection::failCommit(const WriteAheadLog::Progress& progress) {
+    for (size_t i = 0; i < outQueue.size(); i++) {
+        const HttpResponse& held = outQueue[i].response;
+        if (held.logSequence <= (held.logSynced ? progress.synced : progress.written)) continue;
+
+        for (size_t dropped = i; dropped < outQueue.size(); dropped++) {
+            queuedBytes -= outQueue[dropped].response.wireSize(outQueue[dropped].keepAlive);
+        }
+        outQueue.erase(outQueue.begin() + i, outQueue.end());
+
+        json response;
+        response["success"] = false;
+        response["message"] = "Change could not be saved";
+        queueResponse(buildHttpResponse(503, "Service Unavailable", response.dump()), false);
+        break;
+    }
+    awaitedWrittenSequence = 0;
+    awaitedSyncedSequence = 0;
+    closeAfterFlush = true;
+}
+
+//   filler for up to maxIov iovecs covering unsent responses in order, returns how many were filled
+int Connection::gatherOutput(struct iovec* iov, int maxIov) const {
+    int count = 0;
+    size_t skip = outOffset;
+
+    for (auto& pending : outQueue) {
+        if (count + HTTP_RESPONSE_SEGMENTS > maxIov) break;
+
+        struct iovec segments[HTTP_RESPONSE_SEGMENTS];
+        pending.response.segments(segments, pending.keepAlive);
+        for (auto& segment : segments) {
+            //   the partially written front response resumes mid-segment
+            if (skip >= segment.iov_len) {
+                skip -= segment.iov_len;
+                continue;
+            }
+            iov[count].iov_base = (char*)segment.iov_base + skip;
+            iov[count].iov_len = segment.iov_len - skip;
+            skip = 0;
+            count++;
+        }
+
+        //   nothing behind a streamed body may go out before its terminating chunk
+        if (pending.response.stream && !pending.response.streamDone) break;
+    }
+    return count;
+}
+
+//   checker whether a streamed body still has chunks to produce beyond pendingOutputSize()
+bool Connection::streamingOutput() const {
+    for (auto& pending : outQueue) {
+        if (pending.response.stream && !pending.response.streamDone) return true;
+    }
+    return false;
+}
+
+//   checker whether more input can be taken; processInput() stops at the same output limit
+bool Connection::wantsInput() const {
+    return !peerClosed && !closeAfterFlush && currentState != CLOSING && pendingOutputSize() < MAX_PENDING_OUTPUT;
+}
+
+//   marker for bytes the socket accepted, returns to READING (or CLOSING) once fully flushed
+void Connection::consumeOutput(size_t length) {
+    outOffset += length;
+    writeProgress = chrono::steady_clock::now();
+
+    //   fully written responses are released as soon as the socket has them
+    while (!outQueue.empty()) {
+        PendingResponse& front = outQueue.front();
+        size_t frontSize = front.response.wireSize(front.keepAlive);
+        if (outOffset < frontSize) break;
+        outOffset -= frontSize;
+        queuedBytes -= frontSize;
+
+        //   a streamed body is refilled in place until its terminating chunk has gone out
+        if (front.response.stream && !front.response.streamDone) {
+            front.response.headSent = true;
+            front.response.advanceStream();
+            queuedBytes += front.response.wireSize(front.keepAlive);
+            continue;
+        }
+        outQueue.pop_front();
+    }
+
+    if (currentState == WRITING && outQueue.empty()) {
+        outOffset = 0;
+        currentState = closeAfterFlush ? CLOSING : READING;
+        idleStart = writeProgress;
+    }
+}
+
+//   marker for a peer that stopped sending, closes after pending responses are flushed
+void Connection::markPeerClosed() {
+    peerClosed = true;
+    if (currentState == READING && inOffset == inBuffer.size()) {
+        currentState = CLOSING;
+    }
+}
+
+//   builder for a deadline timeout seconds after start, left unarmed when the timeout is 0 (disabled)
+static Connection::Deadline deadlineAfter(ReapReason reason, chrono::steady_clock::time_point start, int timeout) {
+    return {timeout > 0, reason, start + chrono::seconds(timeout)};
+}
+
+//   deadline for the current phase: header, body, keep-alive idle or write, none once closing
+Connection::Deadline Connection::deadline(const ServerConfig& config) const {
+    if (currentState == CLOSING) {
+        return {false, REAP_IDLE_TIMEOUT, {}};
+    }
+    if (currentState == WRITING) {
+        return deadlineAfter(REAP_WRITE_TIMEOUT, writeProgress, config.writeTimeout);
+    }
+
+    //   a partly received request, or a fresh connection that has not sent one yet
+    if (inOffset < inBuffer.size() || awaitingFirstRequest) {
+        if (bodyStarted) {
+            return deadlineAfter(REAP_BODY_TIMEOUT, bodyStart, config.bodyTimeout);
+        }
+        return deadlineAfter(REAP_HEADER_TIMEOUT, requestStart, config.headerTimeout);
+    }
+    return deadlineAfter(REAP_IDLE_TIMEOUT, idleStart, config.keepAliveTimeout);
+}
@@ -0,0 +1,137 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <string>
+#include <chrono>
+#include <deque>
+#include <sys/uio.h>
+#include "datastore.h"
+#include "http.h"
+#include "router.h"
+#include "config.h"
+#include "metrics.h"
+#include "timerwheel.h"
+
+using namespace std;
+
+//   connection state section - per-client read/write state machine driven by the event loop
+
+//   resolution the event loops track connection deadlines at
+static const chrono::milliseconds CONNECTION_TIMER_TICK(100);
+
+class Connection {
+public:
+    //   states a client connection moves through
+    enum State {
+        READING,    // no response pending, waiting for the next request
+        WRITING,    // responses queued, flushing to the socket
+        CLOSING     // done, loop should close the socket
+    };
+
+    //   deadline the connection is currently running against, if any
+    struct Deadline {
+        bool armed;
+        ReapReason reason;
+        chrono::steady_clock::time_point at;
+    };
+
+    Connection(int fd, int maxRequests, size_t maxBodyBytes);
+
+    int fd() const { return socketFd; }
+    State state() const { return currentState; }
+
+    // appender for freshly received bytes
+    void appendInput(const char* data, size_t length);
+
+    // processor for every complete request in the input buffer, queues one response per request in order
+    void processInput(DataStore& store);
+
+    // filler for up to maxIov iovecs covering unsent responses in order, returns how many were filled
+    int gatherOutput(struct iovec* iov, int maxIov) const;
+
+    // response bytes not yet written, for a streamed body only up to the end of its current chunk
+    size_t pendingOutputSize() const { return queuedBytes - outOffset; }
+
+    // checker whether a streamed body still has chunks to produce beyond pendingOutputSize()
+    bool streamingOutput() const;
+
+    // checker whether the event loop should read more input: not once the peer closed or the connection is closing,
+    // and not while queued output is backed up, so a client that never reads its responses cannot grow inBuffer
+    bool wantsInput() const;
+
+    // marker for bytes the socket accepted, returns to READING (or CLOSING) once fully flushed
+    void consumeOutput(size_t length);
+
+    // marker for a peer that stopped sending, closes after the requests it sent are answered; call processInput()
+    // next if input is buffered
+    void markPeerClosed();
+
+    // checker whether the connection closes once its pending output is flushed
+    bool closesAfterFlush() const { return closeAfterFlush; }
+
+    // marker for a peer that errored or timed out
+    void markClosing() { currentState = CLOSING; }
+
+    // deadline for the current phase: header, body, keep-alive idle or write, none once closing
+    Deadline deadline(const ServerConfig& config) const;
+
+    // timer the owning event loop schedules deadline() on
+    WheelTimer& timer() { return deadlineTimer; }
+
+    // newest write-ahead log records queued responses acknowledge as written and as synced, 0 if none; while
+    // either is set the event loop holds all output and waits for the log once per loop iteration (group commit)
+    uint64_t awaitedWrite() const { return awaitedWrittenSequence; }
+    uint64_t awaitedSync() const { return awaitedSyncedSequence; }
+    bool awaitingLog() const { return awaitedWrittenSequence > 0 || awaitedSyncedSequence > 0; }
+
+    // releaser for held output once the log is written and synced as far as progress says; a hold on a newer
+    // record stays, unless the log broke and it never will get there (failCommit)
+    void commitReached(const WriteAheadLog::Progress& progress) {
+        if (awaitedWrittenSequence <= progress.written) awaitedWrittenSequence = 0;
+        if (awaitedSyncedSequence <= progress.synced) awaitedSyncedSequence = 0;
+        if (progress.failed && awaitingLog()) {
+            failCommit(progress);
+        }
+    }
+
+private:
+    //   queued response together with the Connection header it goes out with
+    struct PendingResponse {
+        HttpResponse response;
+        bool keepAlive;
+    };
+
+    // queuer for one response, its buffers are written as-is without being copied together
+    void queueResponse(HttpResponse response, bool keepAlive);
+
+    // closer after the newest queued response, which announces it with Connection: close if not yet started
+    void closeWithLastResponse();
+
+    // replacer for the first held response whose record the broken log lost with a 503, closing after it
+    void failCommit(const WriteAheadLog::Progress& progress);
+
+    int socketFd;
+    State currentState = READING;
+    int requestsLeft;
+    bool closeAfterFlush = false;
+    bool peerClosed = false;
+    string inBuffer;
+    size_t inOffset = 0;
+    HttpParser parser;
+    deque<PendingResponse> outQueue;
+    size_t queuedBytes = 0;     // wire bytes of every response in outQueue
+    size_t outOffset = 0;       // bytes of the front response already written
+    uint64_t awaitedWrittenSequence = 0;
+    uint64_t awaitedSyncedSequence = 0;
+
+    //   start of each deadline phase
+    bool awaitingFirstRequest = true;
+    bool bodyStarted = false;
+    chrono::steady_clock::time_point requestStart;     // first byte of the pending request, or accept
+    chrono::steady_clock::time_point bodyStart;        // end of the pending request's headers
+    chrono::steady_clock::time_point idleStart;        // last response fully flushed
+    chrono::steady_clock::time_point writeProgress;    // last time the client accepted output
+    WheelTimer deadlineTimer;
+};
+
+#endif // CONNECTION_H
@@ -1,386 +1,905 @@
 #include "datastore.h"
+#include <iostream>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include "metrics.h"
 
-DataStore::DataStore() {
+DataStore::DataStore(const ServerConfig& config)
+    : wal(walFile, config.walSync != "none", chrono::microseconds(max(config.groupCommitWindow, 0)),
+          max(config.groupCommitMax, 1)) {
+    if (!WriteAheadLog::parseDurability(config.durability, writeDurability)) {
+        cerr << "Unknown DURABILITY \"" << config.durability << "\", using fsync" << endl;
+    }
+    if (!WriteAheadLog::parseDurability(config.enrollDurability, enrollmentDurability)) {
+        cerr << "Unknown ENROLL_DURABILITY \"" << config.enrollDurability << "\", using write" << endl;
+    }
+    size_t shardCount = min((size_t)max(config.shards, 1), MAX_SHARDS);
+    for (size_t shard = 0; shard < shardCount; shard++) {
+        shards.push_back(make_unique<LeftRight<StudentShard>>());
+    }
     loadData();
 }
 
-//   loader for data from JSON file
+//   loader for the tables from the binary snapshot, or from data.json if there is none yet, then the log replayed
+//   on top
 void DataStore::loadData() {
-    ifstream file(dataFile);
-    if (file.is_open()) {
-        json data;
-        file >> data;
-        
-        //   loader for users
-        if (data.contains("users")) {
-            for (auto& u : data["users"]) {
-                User user;
-                user.id = u.value("id", "");
-                user.username = u.value("username", "");
-                user.password = u.value("password", "");
-                user.role = u.value("role", "");
-                user.name = u.value("name", "");
-                user.firstName = u.value("firstName", "");
-                user.lastName = u.value("lastName", "");
-                user.dateOfBirth = u.value("dateOfBirth", "");
-                user.email = u.value("email", "");
-                users.push_back(user);
-            }
+    SnapshotTables tables;
+    string error;
+    bool loaded = readBinarySnapshot(snapshotFile, tables, error);
+    if (!loaded && !error.empty()) {
+        //   the log alone cannot rebuild the tables, so a damaged snapshot stops startup instead of being replaced
+        cerr << "Error reading snapshot " << snapshotFile << ": " << error << endl;
+        exit(1);
+    }
+    
+    bool imported = false;
+    if (!loaded) {
+        loaded = imported = readJsonSnapshot(dataFile, tables, error);
+        if (!loaded && !error.empty()) {
+            cerr << "Error reading " << dataFile << ": " << error << endl;
+            exit(1);
         }
-        
-        //   loader for courses
-        if (data.contains("courses")) {
-            for (auto& c : data["courses"]) {
-                Course course;
-                course.id = c.value("id", "");
-                course.name = c.value("name", "");
-                course.teacherId = c.value("teacherId", "");
-                course.description = c.value("description", "");
-                courses.push_back(course);
+    }
+    
+    if (!loaded) {
+        //   initializer with default data; a log without its snapshot is meaningless, the first snapshot deletes it
+        wal.open(0, [](string_view) {});
+        initializeDefaultData();
+        return;
+    }
+    
+    adoptTables(tables);
+    
+    //   replayer for the mutations made since the snapshot, the segments before walSegment it already covers
+    replaying = true;
+    size_t replayed = wal.open(tables.walSegment, [this](string_view payload) { replayRecord(payload); });
+    replaying = false;
+    if (replayed > 0) {
+        cout << "Replayed " << replayed << " write-ahead log records" << endl;
+    }
+    
+    //   data.json is only read until the first binary snapshot exists
+    if (imported) {
+        cout << "Imported " << dataFile << ", writing snapshot " << snapshotFile << endl;
+        saveData();
+    }
+}
+
+//   loader for both copies of the directory and of every shard, each shard getting the rows of its students; the
+//   rows are moved into one copy (the enrollments and grades once more through a vector per shard, the table
+//   freed before the next is built) and the other copy is copied from it
+void DataStore::adoptTables(SnapshotTables& tables) {
+    vector<vector<Enrollment>> shardEnrollments(shards.size());
+    vector<vector<Grade>> shardGrades(shards.size());
+    for (const Enrollment& enrollment : tables.enrollments) {
+        shardEnrollments[shardOf(enrollment.studentId)].push_back(enrollment);
+    }
+    vector<Enrollment>().swap(tables.enrollments);
+    for (const Grade& grade : tables.grades) {
+        shardGrades[shardOf(grade.studentId)].push_back(grade);
+    }
+    vector<Grade>().swap(tables.grades);
+    
+    strings = tables.text;
+    directory.reset([&](Directory& copy) { copy.load(tables); });
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        shards[shard]->reset([&](StudentShard& copy) { copy.load(shardEnrollments[shard], shardGrades[shard]); });
+    }
+}
+
+//   sides the calling thread's outermost ReadGuard pinned, depth 0 outside of one; the server has one DataStore
+struct ReaderPins {
+    int depth = 0;
+    int slot = 0;
+    int directory = 0;
+    int shards[DataStore::MAX_SHARDS];
+};
+static thread_local ReaderPins pins;
+
+//   pin to the directory and every shard; inner guards find the thread already pinned and do nothing
+DataStore::ReadGuard::ReadGuard(DataStore& store) : store(store) {
+    if (pins.depth++ > 0) return;
+    pins.slot = leftRightSlot();
+    pins.directory = store.directory.pin(pins.slot);
+    for (size_t shard = 0; shard < store.shards.size(); shard++) {
+        pins.shards[shard] = store.shards[shard]->pin(pins.slot);
+    }
+}
+
+DataStore::ReadGuard::~ReadGuard() {
+    if (--pins.depth > 0) return;
+    store.directory.unpin(pins.directory, pins.slot);
+    for (size_t shard = 0; shard < store.shards.size(); shard++) {
+        store.shards[shard]->unpin(pins.shards[shard], pins.slot);
+    }
+}
+
+//   copies the calling thread's ReadGuard pinned
+const Directory& DataStore::readDirectory() const {
+    return directory.side(pins.directory);
+}
+
+const StudentShard& DataStore::readShard(size_t shard) const {
+    return shards[shard]->side(pins.shards[shard]);
+}
+
+//   sequence number of the last record the calling thread appended, 0 before its first
+static thread_local uint64_t threadLogSequence = 0;
+
+//   appender for one mutation record to the log, called under the writer lock of the pair it changed so each
+//   pair's records are logged in the order they were applied
+void DataStore::logMutation(const json& record) {
+    if (!replaying) {
+        threadLogSequence = wal.append(record.dump());
+    }
+}
+
+//   sequence number of the last mutation the calling thread logged
+uint64_t DataStore::logSequence() {
+    return threadLogSequence;
+}
+
+//   applier for one logged mutation; a record that does not parse is skipped rather than aborting startup
+void DataStore::replayRecord(string_view payload) {
+    json record = json::parse(payload, nullptr, false);
+    if (record.is_discarded() || !record.is_object()) {
+        cerr << "Skipping unreadable write-ahead log record" << endl;
+        return;
+    }
+    
+    string op = record.value("op", "");
+    if (op == "addUser") {
+        json fields = record.value("user", json::object());
+        User user;
+        UserDetails details;
+        userFromJson(fields, internId(fields.value("id", "")), *strings, user, details);
+        addUser(user, details);
+    } else if (op == "assign") {
+        assignTeacherToCourse(record.value("teacherId", ""), record.value("courseId", ""));
+    } else if (op == "enroll") {
+        enrollStudent(record.value("studentId", ""), record.value("courseId", ""));
+    } else if (op == "unenroll") {
+        unenrollStudent(record.value("studentId", ""), record.value("courseId", ""));
+    } else if (op == "grade") {
+        addOrUpdateGrade(record.value("studentId", ""), record.value("courseId", ""), record.value("score", 0),
+                         record.value("note", ""), record.value("teacherId", ""));
+    } else if (op == "deleteGrade") {
+        deleteGrade(record.value("studentId", ""), record.value("courseId", ""));
+    }
+}
+
+//   handle for an external id, interning it on first use
+IdHandle Directory::internId(string_view id) {
+    auto it = idHandles.find(id);
+    if (it != idHandles.end()) {
+        return it->second;
+    }
+    IdHandle handle = idNames.size();
+    idNames.emplace_back(id);
+    idHandles.emplace(idNames.back(), handle);
+    return handle;
+}
+
+//   handle for an external id, NO_ID if it was never interned
+IdHandle Directory::findId(string_view id) const {
+    auto it = idHandles.find(id);
+    return it != idHandles.end() ? it->second : NO_ID;
+}
+
+//   string form of an id handle
+const string& Directory::idString(IdHandle id) const {
+    static const string none;
+    return id < idNames.size() ? idNames[id] : none;
+}
+
+//   grower for a handle-indexed table so that handle is a valid position
+template <typename T>
+static T& slotFor(vector<T>& table, IdHandle handle, const T& fill) {
+    if (handle >= table.size()) {
+        table.resize(handle + 1, fill);
+    }
+    return table[handle];
+}
+
+//   indexer for the user at slot; the first user with a given id or username keeps the entry
+void Directory::indexUser(size_t slot) {
+    const User& user = users[slot];
+    uint32_t& idSlot = slotFor(userSlots, user.id, NO_SLOT);
+    if (idSlot == NO_SLOT) {
+        idSlot = slot;
+    }
+    usernameIndex.emplace(text->view(user.username), slot);
+    if (user.role == Role::TEACHER) {
+        teacherCount++;
+    } else if (user.role == Role::STUDENT) {
+        studentCount++;
+    }
+}
+
+//   indexer for the course at slot; the first course with a given id keeps the entry
+void Directory::indexCourse(size_t slot) {
+    uint32_t& idSlot = slotFor(courseSlots, courses[slot].id, NO_SLOT);
+    if (idSlot == NO_SLOT) {
+        idSlot = slot;
+    }
+}
+
+//   loader for the tables and interned ids of a snapshot, then every index rebuilt
+void Directory::load(SnapshotTables& tables) {
+    text = tables.text.get();
+    users = move(tables.users);
+    userDetails = move(tables.userDetails);
+    courses = move(tables.courses);
+    idNames = move(tables.idNames);
+    idHandles.clear();
+    idHandles.reserve(idNames.size());
+    for (IdHandle handle = 0; handle < idNames.size(); handle++) {
+        idHandles.emplace(idNames[handle], handle);
+    }
+    
+    userSlots.assign(idNames.size(), NO_SLOT);
+    courseSlots.assign(idNames.size(), NO_SLOT);
+    usernameIndex.clear();
+    teacherCount = 0;
+    studentCount = 0;
+    usernameIndex.reserve(users.size());
+    for (size_t slot = 0; slot < users.size(); slot++) {
+        indexUser(slot);
+    }
+    for (size_t slot = 0; slot < courses.size(); slot++) {
+        indexCourse(slot);
+    }
+}
+
+//   copier of another directory; a copied idHandles would still view the other one's idNames, so it is rebuilt
+Directory& Directory::operator=(const Directory& other) {
+    users = other.users;
+    userDetails = other.userDetails;
+    courses = other.courses;
+    idNames = other.idNames;
+    idHandles.clear();
+    idHandles.reserve(idNames.size());
+    for (IdHandle handle = 0; handle < idNames.size(); handle++) {
+        idHandles.emplace(idNames[handle], handle);
+    }
+    userSlots = other.userSlots;
+    courseSlots = other.courseSlots;
+    text = other.text;
+    usernameIndex = other.usernameIndex;
+    teacherCount = other.teacherCount;
+    studentCount = other.studentCount;
+    return *this;
+}
+
+//   copier of the tables and interned ids into a snapshot
+void Directory::copyTo(SnapshotTables& tables) const {
+    tables.users = users;
+    tables.userDetails = userDetails;
+    tables.courses = courses;
+    tables.idNames = idNames;
+}
+
+//   adjacency list of a handle, nullptr if it has none
+static const vector<uint32_t>* adjacency(const unordered_map<IdHandle, vector<uint32_t>>& index, IdHandle handle) {
+    auto it = index.find(handle);
+    return it != index.end() ? &it->second : nullptr;
+}
+
+//   inserter for one slot into an adjacency list, keeping it in ascending order
+static void insertSlot(unordered_map<IdHandle, vector<uint32_t>>& index, IdHandle handle, uint32_t slot) {
+    vector<uint32_t>& slots = index[handle];
+    slots.insert(lower_bound(slots.begin(), slots.end(), slot), slot);
+}
+
+//   remover for one slot from an adjacency list, dropping the list once it is empty
+static void eraseSlot(unordered_map<IdHandle, vector<uint32_t>>& index, IdHandle handle, uint32_t slot) {
+    auto it = index.find(handle);
+    vector<uint32_t>& slots = it->second;
+    auto position = lower_bound(slots.begin(), slots.end(), slot);
+    if (position != slots.end() && *position == slot) {
+        slots.erase(position);
+    }
+    if (slots.empty()) {
+        index.erase(it);
+    }
+}
+
+//   slot for a new row: the most recently tombstoned one, else a fresh one at the end
+template <typename Row>
+static size_t claimSlot(vector<Row>& rows, vector<uint32_t>& freeSlots, const Row& row) {
+    if (freeSlots.empty()) {
+        rows.push_back(row);
+        return rows.size() - 1;
+    }
+    size_t slot = freeSlots.back();
+    freeSlots.pop_back();
+    rows[slot] = row;
+    return slot;
+}
+
+//   indexer for the enrollment at slot in both directions
+void StudentShard::indexEnrollment(size_t slot) {
+    insertSlot(enrollmentsByStudent, enrollments[slot].studentId, slot);
+    insertSlot(enrollmentsByCourse, enrollments[slot].courseId, slot);
+}
+
+//   finder for the slot of a student's enrollment in a course, enrollments.size() if there is none
+size_t StudentShard::findEnrollment(IdHandle studentId, IdHandle courseId) const {
+    const vector<uint32_t>* slots = adjacency(enrollmentsByStudent, studentId);
+    if (slots != nullptr) {
+        for (uint32_t slot : *slots) {
+            if (enrollments[slot].courseId == courseId) {
+                return slot;
             }
         }
-        
-        //   loader for enrollments
-        if (data.contains("enrollments")) {
-            for (auto& e : data["enrollments"]) {
-                Enrollment enrollment;
-                enrollment.studentId = e.value("studentId", "");
-                enrollment.courseId = e.value("courseId", "");
-                enrollments.push_back(enrollment);
-            }
+    }
+    return enrollments.size();
+}
+
+//   remover for the enrollment at slot; no other row moves, the slot is tombstoned until a new row takes it
+void StudentShard::removeEnrollmentAt(size_t slot) {
+    eraseSlot(enrollmentsByStudent, enrollments[slot].studentId, slot);
+    eraseSlot(enrollmentsByCourse, enrollments[slot].courseId, slot);
+    enrollments[slot].studentId = NO_ID;
+    freeEnrollments.push_back(slot);
+}
+
+//   loader for this shard's rows, packed without tombstones, then every index rebuilt
+void StudentShard::load(vector<Enrollment>& shardEnrollments, vector<Grade>& shardGrades) {
+    enrollments = move(shardEnrollments);
+    grades = move(shardGrades);
+    freeEnrollments.clear();
+    freeGrades.clear();
+    enrollmentsByStudent.clear();
+    enrollmentsByCourse.clear();
+    gradesByStudent.clear();
+    gradeIndex.clear();
+    
+    //   slots are visited in ascending order, so appending keeps every adjacency list sorted
+    for (size_t slot = 0; slot < enrollments.size(); slot++) {
+        enrollmentsByStudent[enrollments[slot].studentId].push_back(slot);
+        enrollmentsByCourse[enrollments[slot].courseId].push_back(slot);
+    }
+    gradeIndex.reserve(grades.size());
+    for (size_t slot = 0; slot < grades.size(); slot++) {
+        gradeIndex.emplace(gradeKey(grades[slot].studentId, grades[slot].courseId), slot);
+        gradesByStudent[grades[slot].studentId].push_back(slot);
+    }
+}
+
+//   appender of this shard's live rows to a snapshot
+void StudentShard::copyTo(SnapshotTables& tables) const {
+    for (const Enrollment& enrollment : enrollments) {
+        if (enrollment.studentId != NO_ID) {
+            tables.enrollments.push_back(enrollment);
         }
-        
-        //   loader for grades
-        if (data.contains("grades")) {
-            for (auto& g : data["grades"]) {
-                Grade grade;
-                grade.studentId = g.value("studentId", "");
-                grade.courseId = g.value("courseId", "");
-                grade.score = g.value("score", 0);
-                grade.note = g.value("note", "");
-                grade.teacherId = g.value("teacherId", "");
-                grades.push_back(grade);
-            }
+    }
+    for (const Grade& grade : grades) {
+        if (grade.studentId != NO_ID) {
+            tables.grades.push_back(grade);
         }
-        
-        file.close();
-    } else {
-        //   initializer with default data
-        initializeDefaultData();
     }
 }
 
-//   saver for data to JSON file
-void DataStore::saveData() {
-    json data;
+//   saver for the tables to a binary snapshot
+bool DataStore::saveData() {
+    //   one snapshot at a time, they share the log's segment numbering
+    lock_guard<mutex> snapshotGuard(snapshotLock);
     
-    //   saver for users
-    data["users"] = json::array();
-    for (auto& u : users) {
-        json user;
-        user["id"] = u.id;
-        user["username"] = u.username;
-        user["password"] = u.password;
-        user["role"] = u.role;
-        user["firstName"] = u.firstName;
-        user["lastName"] = u.lastName;
-        user["dateOfBirth"] = u.dateOfBirth;
-        user["email"] = u.email;
-        user["name"] = u.name;
-        data["users"].push_back(user);
+    //   every writer lock is held (directory first, then the shards in order) only to cut the log and pin the
+    //   published copies, so the pinned copies hold exactly the records before firstSegment
+    SnapshotTables tables;
+    uint64_t firstSegment;
+    int slot = leftRightSlot();
+    int directorySide;
+    vector<int> shardSides(shards.size());
+    {
+        lock_guard<mutex> directoryGuard(directory.writerLock());
+        vector<unique_lock<mutex>> shardGuards;
+        for (auto& shard : shards) {
+            shardGuards.emplace_back(shard->writerLock());
+        }
+        firstSegment = wal.cut();
+        directorySide = directory.pin(slot);
+        for (size_t shard = 0; shard < shards.size(); shard++) {
+            shardSides[shard] = shards[shard]->pin(slot);
+        }
     }
     
-    //   saver for courses
-    data["courses"] = json::array();
-    for (auto& c : courses) {
-        json course;
-        course["id"] = c.id;
-        course["name"] = c.name;
-        course["teacherId"] = c.teacherId;
-        course["description"] = c.description;
-        data["courses"].push_back(course);
+    //   copied with no lock held; each copy is unpinned as soon as it is taken, so a writer waits at most once per
+    //   snapshot, for the copy of the table it changes (its change is applied to the other copy and published
+    //   first, readers never wait)
+    directory.side(directorySide).copyTo(tables);
+    directory.unpin(directorySide, slot);
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        shards[shard]->side(shardSides[shard]).copyTo(tables);
+        shards[shard]->unpin(shardSides[shard], slot);
     }
+    tables.walSegment = firstSegment;
+    tables.text = strings;
     
-    //   saver for enrollments
-    data["enrollments"] = json::array();
-    for (auto& e : enrollments) {
-        json enrollment;
-        enrollment["studentId"] = e.studentId;
-        enrollment["courseId"] = e.courseId;
-        data["enrollments"].push_back(enrollment);
+    //   the segments before the cut are written and synced, and appends switched past it, before the snapshot
+    //   may replace them
+    if (wal.rotate() != firstSegment) {
+        countMetric(serverMetrics().snapshotFailures);
+        return false;
     }
     
-    //   saver for grades
-    data["grades"] = json::array();
-    for (auto& g : grades) {
-        json grade;
-        grade["studentId"] = g.studentId;
-        grade["courseId"] = g.courseId;
-        grade["score"] = g.score;
-        grade["note"] = g.note;
-        grade["teacherId"] = g.teacherId;
-        data["grades"].push_back(grade);
+    //   serialized and written with no lock held
+    if (!writeBinarySnapshot(snapshotFile, tables)) {
+        cerr << "Error writing snapshot " << snapshotFile << ": " << strerror(errno) << endl;
+        countMetric(serverMetrics().snapshotFailures);
+        return false;
     }
-    
-    ofstream file(dataFile);
-    file << data.dump(4);
-    file.close();
+    wal.removeBefore(firstSegment);
+    countMetric(serverMetrics().snapshotsWritten);
+    return true;
 }
 
-//   initializer with sample data
+//   initializer with sample data, loaded like a snapshot and written out as the first one
 void DataStore::initializeDefaultData() {
+    SnapshotTables tables;
+    unordered_map<string, IdHandle> handles;
+    auto internId = [&](const string& id) {
+        auto it = handles.emplace(id, tables.idNames.size());
+        if (it.second) {
+            tables.idNames.push_back(id);
+        }
+        return it.first->second;
+    };
+    tables.text = make_shared<StringPool>();
+    auto text = [&](string_view value) { return tables.text->intern(value); };
+    auto addSampleUser = [&](const char* id, const char* username, const char* password, const char* role,
+                             const char* name, const char* firstName, const char* lastName,
+                             const char* dateOfBirth, const char* email) {
+        tables.users.push_back({internId(id), roleFromName(role), text(username), text(name)});
+        tables.userDetails.push_back({text(password), text(role), text(firstName), text(lastName),
+                                      text(dateOfBirth), text(email)});
+    };
+    vector<Course>& courses = tables.courses;
+    vector<Enrollment>& enrollments = tables.enrollments;
+    vector<Grade>& grades = tables.grades;
+    
     //   adder for teachers (each teaches ONE course)
-    users.push_back({"T001", "mrsmith", "teacher123", "teacher", "Mr. Smith", "Mr", "Smith", "", "mrsmith@school.edu"});
-    users.push_back({"T002", "msjones", "teacher123", "teacher", "Ms. Jones", "Ms", "Jones", "", "msjones@school.edu"});
-    users.push_back({"T003", "mrwilson", "teacher123", "teacher", "Mr. Wilson", "Mr", "Wilson", "", "mrwilson@school.edu"});
-    users.push_back({"T004", "msdavis", "teacher123", "teacher", "Ms. Davis", "Ms", "Davis", "", "msdavis@school.edu"});
+    addSampleUser("T001", "mrsmith", "teacher123", "teacher", "Mr. Smith", "Mr", "Smith", "", "mrsmith@school.edu");
+    addSampleUser("T002", "msjones", "teacher123", "teacher", "Ms. Jones", "Ms", "Jones", "", "msjones@school.edu");
+    addSampleUser("T003", "mrwilson", "teacher123", "teacher", "Mr. Wilson", "Mr", "Wilson", "", "mrwilson@school.edu");
+    addSampleUser("T004", "msdavis", "teacher123", "teacher", "Ms. Davis", "Ms", "Davis", "", "msdavis@school.edu");
     
     //   adder for students (IDs auto-generated from first letter of first/last name)
-    users.push_back({"JD001", "john", "john123", "student", "John Doe", "John", "Doe", "2005-03-15", "john@school.edu"});
-    users.push_back({"JS001", "jane", "jane123", "student", "Jane Smith", "Jane", "Smith", "2005-07-22", "jane@school.edu"});
-    users.push_back({"BJ001", "bob", "bob123", "student", "Bob Johnson", "Bob", "Johnson", "2005-11-08", "bob@school.edu"});
+    addSampleUser("JD001", "john", "john123", "student", "John Doe", "John", "Doe", "2005-03-15", "john@school.edu");
+    addSampleUser("JS001", "jane", "jane123", "student", "Jane Smith", "Jane", "Smith", "2005-07-22", "jane@school.edu");
+    addSampleUser("BJ001", "bob", "bob123", "student", "Bob Johnson", "Bob", "Johnson", "2005-11-08", "bob@school.edu");
     
     //   adder for courses (each course has ONE teacher)
-    courses.push_back({"C001", "Mathematics", "T001", "Algebra, Calculus, and Geometry"});
-    courses.push_back({"C002", "English", "T002", "Literature, Grammar, and Writing"});
-    courses.push_back({"C003", "Science", "T003", "Physics, Chemistry, and Biology"});
-    courses.push_back({"C004", "History", "T004", "World History and Civics"});
-    courses.push_back({"C005", "Computer Science", "T001", "Programming and Web Development"});
+    courses.push_back({internId("C001"), text("Mathematics"), internId("T001"), text("Algebra, Calculus, and Geometry")});
+    courses.push_back({internId("C002"), text("English"), internId("T002"), text("Literature, Grammar, and Writing")});
+    courses.push_back({internId("C003"), text("Science"), internId("T003"), text("Physics, Chemistry, and Biology")});
+    courses.push_back({internId("C004"), text("History"), internId("T004"), text("World History and Civics")});
+    courses.push_back({internId("C005"), text("Computer Science"), internId("T001"), text("Programming and Web Development")});
     
     //   adder for enrollments (students can enroll in MANY courses)
-    enrollments.push_back({"JD001", "C001"});
-    enrollments.push_back({"JD001", "C002"});
-    enrollments.push_back({"JD001", "C005"});
+    enrollments.push_back({internId("JD001"), internId("C001")});
+    enrollments.push_back({internId("JD001"), internId("C002")});
+    enrollments.push_back({internId("JD001"), internId("C005")});
     
-    enrollments.push_back({"JS001", "C001"});
-    enrollments.push_back({"JS001", "C002"});
-    enrollments.push_back({"JS001", "C003"});
+    enrollments.push_back({internId("JS001"), internId("C001")});
+    enrollments.push_back({internId("JS001"), internId("C002")});
+    enrollments.push_back({internId("JS001"), internId("C003")});
     
-    enrollments.push_back({"BJ001", "C001"});
-    enrollments.push_back({"BJ001", "C004"});
+    enrollments.push_back({internId("BJ001"), internId("C001")});
+    enrollments.push_back({internId("BJ001"), internId("C004")});
     
     //   adder for sample grades (linked to courses)
-    grades.push_back({"JD001", "C001", 85, "Good progress", "T001"});
-    grades.push_back({"JD001", "C002", 90, "Excellent work", "T002"});
-    grades.push_back({"JD001", "C005", 95, "Outstanding!", "T001"});
+    grades.push_back({internId("JD001"), internId("C001"), 85, text("Good progress"), internId("T001")});
+    grades.push_back({internId("JD001"), internId("C002"), 90, text("Excellent work"), internId("T002")});
+    grades.push_back({internId("JD001"), internId("C005"), 95, text("Outstanding!"), internId("T001")});
     
-    grades.push_back({"JS001", "C001", 78, "Needs improvement", "T001"});
-    grades.push_back({"JS001", "C002", 88, "Very good", "T002"});
-    grades.push_back({"JS001", "C003", 82, "Good effort", "T003"});
+    grades.push_back({internId("JS001"), internId("C001"), 78, text("Needs improvement"), internId("T001")});
+    grades.push_back({internId("JS001"), internId("C002"), 88, text("Very good"), internId("T002")});
+    grades.push_back({internId("JS001"), internId("C003"), 82, text("Good effort"), internId("T003")});
     
-    grades.push_back({"BJ001", "C001", 92, "Outstanding", "T001"});
-    grades.push_back({"BJ001", "C004", 85, "Solid work", "T004"});
+    grades.push_back({internId("BJ001"), internId("C001"), 92, text("Outstanding"), internId("T001")});
+    grades.push_back({internId("BJ001"), internId("C004"), 85, text("Solid work"), internId("T004")});
     
+    adoptTables(tables);
     saveData();
 }
 
 //   authenticator for user
-User* DataStore::authenticateUser(string username, string password) {
-    for (auto& user : users) {
-        if (user.username == username && user.password == password) {
-            return &user;
-        }
+const User* Directory::authenticateUser(const string& username, const string& password) const {
+    auto it = usernameIndex.find(username);
+    if (it == usernameIndex.end() || text->view(userDetails[it->second].password) != password) {
+        return nullptr;
     }
-    return nullptr;
+    return &users[it->second];
 }
 
 //   adder for new user
-void DataStore::addUser(User user) {
+void Directory::addUser(const User& user, const UserDetails& details) {
     users.push_back(user);
-    saveData();
+    userDetails.push_back(details);
+    indexUser(users.size() - 1);
 }
 
-//   counter for teachers
-int DataStore::getTeacherCount() {
-    int count = 0;
-    for (auto& user : users) {
-        if (user.role == "teacher") {
-            count++;
-        }
+//   assigner for teacher to course
+bool Directory::assignTeacherToCourse(IdHandle teacherId, IdHandle courseId) {
+    if (courseId >= courseSlots.size() || courseSlots[courseId] == NO_SLOT) {
+        return false;
     }
-    return count;
+    courses[courseSlots[courseId]].teacherId = teacherId;
+    return true;
 }
 
-//   counter for students
-int DataStore::getStudentCount() {
-    int count = 0;
-    for (auto& user : users) {
-        if (user.role == "student") {
-            count++;
-        }
+//    get user by ID
+const User* Directory::getUserById(IdHandle userId) const {
+    if (userId >= userSlots.size() || userSlots[userId] == NO_SLOT) {
+        return nullptr;
     }
-    return count;
+    return &users[userSlots[userId]];
 }
 
-//   assigner for teacher to course
-void DataStore::assignTeacherToCourse(string teacherId, string courseId) {
-    for (auto& course : courses) {
-        if (course.id == courseId) {
-            course.teacherId = teacherId;
-            saveData();
-            return;
+//    get the cold part of a user by ID
+const UserDetails* Directory::getUserDetails(IdHandle userId) const {
+    if (userId >= userSlots.size() || userSlots[userId] == NO_SLOT) {
+        return nullptr;
+    }
+    return &userDetails[userSlots[userId]];
+}
+
+//    get course by ID
+const Course* Directory::getCourseById(IdHandle courseId) const {
+    if (courseId >= courseSlots.size() || courseSlots[courseId] == NO_SLOT) {
+        return nullptr;
+    }
+    return &courses[courseSlots[courseId]];
+}
+
+//   checker if student is enrolled in a course
+bool StudentShard::isEnrolled(IdHandle studentId, IdHandle courseId) const {
+    return findEnrollment(studentId, courseId) < enrollments.size();
+}
+
+//   visitor over the handles of the courses a student is enrolled in
+void StudentShard::forEachEnrolledCourse(IdHandle studentId, const function<void(IdHandle courseId)>& visit) const {
+    const vector<uint32_t>* slots = adjacency(enrollmentsByStudent, studentId);
+    if (slots != nullptr) {
+        for (uint32_t slot : *slots) {
+            visit(enrollments[slot].courseId);
         }
     }
 }
 
-//    get user by ID
-User* DataStore::getUserById(string userId) {
-    for (auto& user : users) {
-        if (user.id == userId) {
-            return &user;
+//   visitor over the grades of a student, through its adjacency list
+void StudentShard::forEachGradeOfStudent(IdHandle studentId, const function<void(const Grade&)>& visit) const {
+    const vector<uint32_t>* slots = adjacency(gradesByStudent, studentId);
+    if (slots != nullptr) {
+        for (uint32_t slot : *slots) {
+            visit(grades[slot]);
         }
     }
-    return nullptr;
 }
 
-//    get all students
-vector<User> DataStore::getAllStudents() {
-    vector<User> students;
-    for (auto& user : users) {
-        if (user.role == "student") {
-            students.push_back(user);
+//   resumable visitor over the handles of this shard's students enrolled in a course, by enrollment slot
+bool StudentShard::forEachEnrolledStudentFrom(IdHandle courseId, size_t& slot,
+                                              const function<bool(IdHandle studentId)>& visit) const {
+    const vector<uint32_t>* slots = adjacency(enrollmentsByCourse, courseId);
+    if (slots == nullptr) {
+        return false;
+    }
+    for (auto it = lower_bound(slots->begin(), slots->end(), slot); it != slots->end(); ++it) {
+        slot = *it + 1;
+        if (!visit(enrollments[*it].studentId)) {
+            return true;
         }
     }
-    return students;
+    return false;
 }
 
-//    get grades for a student
-vector<Grade> DataStore::getGradesByStudent(string studentId) {
-    vector<Grade> studentGrades;
-    for (auto& grade : grades) {
-        if (grade.studentId == studentId) {
-            studentGrades.push_back(grade);
+//   resumable visitor over this shard's grades, skipping tombstones
+bool StudentShard::forEachGradeFrom(size_t& slot, const function<bool(const Grade&)>& visit) const {
+    while (slot < grades.size()) {
+        const Grade& grade = grades[slot++];
+        if (grade.studentId != NO_ID && !visit(grade)) {
+            return true;
         }
     }
-    return studentGrades;
+    return false;
 }
 
-//    get all courses
-vector<Course> DataStore::getAllCourses() {
-    return courses;
+//   enroller for student in a course
+bool StudentShard::enrollStudent(IdHandle studentId, IdHandle courseId) {
+    if (findEnrollment(studentId, courseId) < enrollments.size()) {
+        return false;
+    }
+    indexEnrollment(claimSlot(enrollments, freeEnrollments, Enrollment{studentId, courseId}));
+    return true;
 }
 
-//    get course by ID
-Course* DataStore::getCourseById(string courseId) {
-    for (auto& course : courses) {
-        if (course.id == courseId) {
-            return &course;
-        }
+//   unenroller for student from a course
+bool StudentShard::unenrollStudent(IdHandle studentId, IdHandle courseId) {
+    size_t slot = findEnrollment(studentId, courseId);
+    if (slot == enrollments.size()) {
+        return false;
     }
-    return nullptr;
+    removeEnrollmentAt(slot);
+    return true;
 }
 
-//    get courses for a specific teacher
-vector<Course> DataStore::getCoursesByTeacher(string teacherId) {
-    vector<Course> teacherCourses;
-    for (auto& course : courses) {
-        if (course.teacherId == teacherId) {
-            teacherCourses.push_back(course);
-        }
+//   add or update grade
+void StudentShard::addOrUpdateGrade(IdHandle studentId, IdHandle courseId, int score, TextHandle note,
+                                    IdHandle teacherId) {
+    //   check if grade exists
+    auto it = gradeIndex.find(gradeKey(studentId, courseId));
+    if (it != gradeIndex.end()) {
+        Grade& grade = grades[it->second];
+        grade.score = score;
+        grade.note = note;
+        grade.teacherId = teacherId;
+        return;
     }
-    return teacherCourses;
+    
+    //   adding new grade
+    size_t slot = claimSlot(grades, freeGrades, Grade{studentId, courseId, score, note, teacherId});
+    gradeIndex.emplace(gradeKey(studentId, courseId), slot);
+    insertSlot(gradesByStudent, studentId, slot);
 }
 
-//    get enrolled courses for a student
-vector<Course> DataStore::getEnrolledCourses(string studentId) {
-    vector<Course> studentCourses;
-    for (auto& enrollment : enrollments) {
-        if (enrollment.studentId == studentId) {
-            Course* course = getCourseById(enrollment.courseId);
-            if (course != nullptr) {
-                studentCourses.push_back(*course);
-            }
-        }
+//   deleting grade
+bool StudentShard::deleteGrade(IdHandle studentId, IdHandle courseId) {
+    auto it = gradeIndex.find(gradeKey(studentId, courseId));
+    if (it == gradeIndex.end()) {
+        return false;
+    }
+    size_t slot = it->second;
+    gradeIndex.erase(it);
+    eraseSlot(gradesByStudent, studentId, slot);
+    
+    //   tombstoned in place, so no other row moves
+    grades[slot].studentId = NO_ID;
+    freeGrades.push_back(slot);
+    return true;
+}
+
+//   handle for an external id; a new one is interned under the directory's writer lock
+IdHandle DataStore::internId(string_view id) {
+    IdHandle handle = findId(id);
+    if (handle != NO_ID) {
+        return handle;
+    }
+    lock_guard<mutex> lock(directory.writerLock());
+    return directory.modify([&](Directory& tables) { return tables.internId(id); });
+}
+
+//   handle for an external id, NO_ID if it was never interned
+IdHandle DataStore::findId(string_view id) {
+    ReadGuard pin(*this);
+    return readDirectory().findId(id);
+}
+
+//   string form of an id handle; the id deques only grow, so the reference outlives the pin
+const string& DataStore::idString(IdHandle id) {
+    ReadGuard pin(*this);
+    return readDirectory().idString(id);
+}
+
+//   authenticator for user
+const User* DataStore::authenticateUser(string username, string password) {
+    ReadGuard pin(*this);
+    return readDirectory().authenticateUser(username, password);
+}
+
+//   adder for new user
+void DataStore::addUser(const User& user, const UserDetails& details) {
+    lock_guard<mutex> lock(directory.writerLock());
+    directory.modify([&](Directory& tables) {
+        tables.addUser(user, details);
+        return true;
+    });
+    logMutation({{"op", "addUser"}, {"user", userToJson(user, details, *strings, directory.current().ids())}});
+}
+
+//   counter for teachers
+int DataStore::getTeacherCount() {
+    ReadGuard pin(*this);
+    return readDirectory().getTeacherCount();
+}
+
+//   counter for students
+int DataStore::getStudentCount() {
+    ReadGuard pin(*this);
+    return readDirectory().getStudentCount();
+}
+
+//   assigner for teacher to course
+void DataStore::assignTeacherToCourse(string teacherId, string courseId) {
+    IdHandle teacher = internId(teacherId);
+    IdHandle course = findId(courseId);
+    lock_guard<mutex> lock(directory.writerLock());
+    if (directory.modify([&](Directory& tables) { return tables.assignTeacherToCourse(teacher, course); })) {
+        logMutation({{"op", "assign"}, {"teacherId", teacherId}, {"courseId", courseId}});
     }
-    return studentCourses;
+}
+
+//    get user by ID
+const User* DataStore::getUserById(string userId) {
+    ReadGuard pin(*this);
+    return readDirectory().getUserById(readDirectory().findId(userId));
+}
+
+const User* DataStore::getUserById(IdHandle userId) {
+    ReadGuard pin(*this);
+    return readDirectory().getUserById(userId);
+}
+
+//    get the cold part of a user by ID
+const UserDetails* DataStore::getUserDetails(IdHandle userId) {
+    ReadGuard pin(*this);
+    return readDirectory().getUserDetails(userId);
+}
+
+
+//   visitor over all courses
+void DataStore::forEachCourse(const function<void(const Course&)>& visit) {
+    ReadGuard pin(*this);
+    for (const Course& course : readDirectory().getAllCourses()) {
+        visit(course);
+    }
+}
+
+//    get course by ID
+const Course* DataStore::getCourseById(string courseId) {
+    ReadGuard pin(*this);
+    return readDirectory().getCourseById(readDirectory().findId(courseId));
+}
+
+const Course* DataStore::getCourseById(IdHandle courseId) {
+    ReadGuard pin(*this);
+    return readDirectory().getCourseById(courseId);
+}
+
+//   visitor over the courses a student is enrolled in, from the student's shard
+void DataStore::forEachEnrolledCourse(string_view studentId, const function<void(const Course&)>& visit) {
+    ReadGuard pin(*this);
+    IdHandle student = readDirectory().findId(studentId);
+    if (student == NO_ID) {
+        return;
+    }
+    readShard(shardOf(student)).forEachEnrolledCourse(student, [&](IdHandle courseId) {
+        const Course* course = readDirectory().getCourseById(courseId);
+        if (course != nullptr) {
+            visit(*course);
+        }
+    });
 }
 
 //   checker if student is enrolled in a course
 bool DataStore::isEnrolled(string studentId, string courseId) {
-    for (auto& enrollment : enrollments) {
-        if (enrollment.studentId == studentId && enrollment.courseId == courseId) {
-            return true;
-        }
+    ReadGuard pin(*this);
+    IdHandle student = readDirectory().findId(studentId);
+    if (student == NO_ID) {
+        return false;
     }
-    return false;
+    return readShard(shardOf(student)).isEnrolled(student, readDirectory().findId(courseId));
 }
 
-//   enroller for student in a course
+//   enroller for student in a course, under the student's shard lock only
 void DataStore::enrollStudent(string studentId, string courseId) {
-    if (!isEnrolled(studentId, courseId)) {
-        enrollments.push_back({studentId, courseId});
-        saveData();
+    IdHandle student = internId(studentId);
+    IdHandle course = internId(courseId);
+    LeftRight<StudentShard>& shard = *shards[shardOf(student)];
+    lock_guard<mutex> lock(shard.writerLock());
+    if (shard.modify([&](StudentShard& tables) { return tables.enrollStudent(student, course); })) {
+        logMutation({{"op", "enroll"}, {"studentId", studentId}, {"courseId", courseId}});
     }
 }
 
-//   unenroller for student from a course
+//   unenroller for student from a course, under the student's shard lock only
 void DataStore::unenrollStudent(string studentId, string courseId) {
-    for (auto it = enrollments.begin(); it != enrollments.end(); ++it) {
-        if (it->studentId == studentId && it->courseId == courseId) {
-            enrollments.erase(it);
-            saveData();
-            return;
-        }
+    IdHandle student = findId(studentId);
+    IdHandle course = findId(courseId);
+    if (student == NO_ID || course == NO_ID) {
+        return;
+    }
+    LeftRight<StudentShard>& shard = *shards[shardOf(student)];
+    lock_guard<mutex> lock(shard.writerLock());
+    if (shard.modify([&](StudentShard& tables) { return tables.unenrollStudent(student, course); })) {
+        logMutation({{"op", "unenroll"}, {"studentId", studentId}, {"courseId", courseId}});
     }
 }
 
-//    get students enrolled in a course
-vector<User> DataStore::getStudentsByCourse(string courseId) {
-    vector<User> enrolledStudents;
-    for (auto& enrollment : enrollments) {
-        if (enrollment.courseId == courseId) {
-            for (auto& user : users) {
-                if (user.id == enrollment.studentId && user.role == "student") {
-                    enrolledStudents.push_back(user);
-                    break;
-                }
-            }
-        }
+
+//   visitor over the grades of a student, from the student's shard
+void DataStore::forEachGradeOfStudent(string_view studentId, const function<void(const Grade&)>& visit) {
+    ReadGuard pin(*this);
+    IdHandle student = readDirectory().findId(studentId);
+    if (student == NO_ID) {
+        return;
     }
-    return enrolledStudents;
+    readShard(shardOf(student)).forEachGradeOfStudent(student, visit);
 }
 
-//    get all grades (for teacher)
-vector<Grade> DataStore::getAllGrades() {
-    return grades;
+//   resumable visitor over all students, by user slot
+bool DataStore::forEachStudentFrom(Cursor& cursor, const function<bool(const User&)>& visit) {
+    ReadGuard pin(*this);
+    const vector<User>& users = readDirectory().getAllUsers();
+    while (cursor.slot < users.size()) {
+        const User& user = users[cursor.slot++];
+        if (user.role == Role::STUDENT && !visit(user)) {
+            return true;
+        }
+    }
+    return false;
 }
 
-//    get grades for a teacher's courses
-vector<Grade> DataStore::getGradesByTeacher(string teacherId) {
-    vector<Grade> teacherGrades;
-    for (auto& grade : grades) {
-        if (grade.teacherId == teacherId) {
-            teacherGrades.push_back(grade);
+//   resumable visitor over the students enrolled in a course, by shard and enrollment slot
+bool DataStore::forEachStudentInCourseFrom(string_view courseId, Cursor& cursor,
+                                           const function<bool(const User&)>& visit) {
+    ReadGuard pin(*this);
+    IdHandle course = readDirectory().findId(courseId);
+    if (course == NO_ID) {
+        return false;
+    }
+    for (; cursor.shard < shards.size(); cursor.shard++, cursor.slot = 0) {
+        bool stopped = readShard(cursor.shard).forEachEnrolledStudentFrom(course, cursor.slot, [&](IdHandle studentId) {
+            const User* user = readDirectory().getUserById(studentId);
+            return user == nullptr || user->role != Role::STUDENT || visit(*user);
+        });
+        if (stopped) {
+            return true;
         }
     }
-    return teacherGrades;
+    return false;
 }
 
-//   add or update grade
-void DataStore::addOrUpdateGrade(string studentId, string courseId, int score, string note, string teacherId) {
-    //   check if grade exists
-    for (auto& grade : grades) {
-        if (grade.studentId == studentId && grade.courseId == courseId) {
-            grade.score = score;
-            grade.note = note;
-            grade.teacherId = teacherId;
-            saveData();
-            return;
+//   resumable visitor over the grades a teacher gave, by shard and grade slot
+bool DataStore::forEachGradeOfTeacherFrom(string_view teacherId, Cursor& cursor,
+                                          const function<bool(const Grade&)>& visit) {
+    ReadGuard pin(*this);
+    IdHandle teacher = readDirectory().findId(teacherId);
+    if (teacher == NO_ID) {
+        return false;
+    }
+    for (; cursor.shard < shards.size(); cursor.shard++, cursor.slot = 0) {
+        bool stopped = readShard(cursor.shard).forEachGradeFrom(cursor.slot, [&](const Grade& grade) {
+            return grade.teacherId != teacher || visit(grade);
+        });
+        if (stopped) {
+            return true;
         }
     }
-    
-    //   adding new grade
-    grades.push_back({studentId, courseId, score, note, teacherId});
-    saveData();
+    return false;
 }
 
-//   deleting grade
+
+//   add or update grade, under the student's shard lock only
+void DataStore::addOrUpdateGrade(string studentId, string courseId, int score, string note, string teacherId) {
+    IdHandle student = internId(studentId);
+    IdHandle course = internId(courseId);
+    IdHandle teacher = internId(teacherId);
+    TextHandle noteText = internText(note);
+    LeftRight<StudentShard>& shard = *shards[shardOf(student)];
+    lock_guard<mutex> lock(shard.writerLock());
+    shard.modify([&](StudentShard& tables) {
+        tables.addOrUpdateGrade(student, course, score, noteText, teacher);
+        return true;
+    });
+    logMutation({{"op", "grade"}, {"studentId", studentId}, {"courseId", courseId}, {"score", score},
+                 {"note", note}, {"teacherId", teacherId}});
+}
+
+//   deleting grade, under the student's shard lock only
 void DataStore::deleteGrade(string studentId, string courseId) {
-    for (auto it = grades.begin(); it != grades.end(); ++it) {
-        if (it->studentId == studentId && it->courseId == courseId) {
-            grades.erase(it);
-            saveData();
-            return;
-        }
+    IdHandle student = findId(studentId);
+    IdHandle course = findId(courseId);
+    if (student == NO_ID || course == NO_ID) {
+        return;
+    }
+    LeftRight<StudentShard>& shard = *shards[shardOf(student)];
+    lock_guard<mutex> lock(shard.writerLock());
+    if (shard.modify([&](StudentShard& tables) { return tables.deleteGrade(student, course); })) {
+        logMutation({{"op", "deleteGrade"}, {"studentId", studentId}, {"courseId", courseId}});
     }
 }
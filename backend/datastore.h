@@ -2,92 +2,337 @@
 #define DATASTORE_H
 
 #include <vector>
+#include <deque>
+#include <string_view>
+#include <unordered_map>
 #include <fstream>
+#include <mutex>
+#include <memory>
+#include <functional>
 #include "json.hpp"
 #include "models.h"
+#include "config.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "leftright.h"
 
 using json = nlohmann::json;
 using namespace std;
 
-//   data storage section - manages users, courses, enrollments, and grades with JSON persistence
+//   data storage section - manages users, courses, enrollments, and grades, persisted as a binary snapshot plus a
+//   write-ahead log of the mutations made since
 
-class DataStore {
+//   users, courses and the id interner, shared by every shard. DataStore keeps it in a left-right pair, so
+//   every mutator here must be deterministic: both copies end up identical, slots and id handles included
+class Directory {
 private:
+    // hot and cold parts of each user, at the same slot in both
     vector<User> users;
+    vector<UserDetails> userDetails;
     vector<Course> courses;
+
+    // interned ids: string form by handle (a deque, so the views keyed below never move) and handle by string
+    deque<string> idNames;
+    unordered_map<string_view, IdHandle> idHandles;
+
+    // slot of the user / course with a given id handle, NO_SLOT where there is none
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+    vector<uint32_t> userSlots;
+    vector<uint32_t> courseSlots;
+
+    // pool the text handles of users and courses refer to, shared with the DataStore
+    const StringPool* text = nullptr;
+
+    // hash index from username (a view into the pool) to the user's slot
+    unordered_map<string_view, uint32_t> usernameIndex;
+    int teacherCount = 0;
+    int studentCount = 0;
+
+    // indexer for the user at slot; the first user with a given id or username keeps the entry
+    void indexUser(size_t slot);
+
+    // indexer for the course at slot; the first course with a given id keeps the entry
+    void indexCourse(size_t slot);
+
+public:
+    Directory() = default;
+    Directory(const Directory& other) { *this = other; }
+
+    // copier of another directory, its id index keyed by this copy's own idNames
+    Directory& operator=(const Directory& other);
+
+    // loader for the tables and interned ids of a snapshot, replacing what was there; they are moved out of tables
+    void load(SnapshotTables& tables);
+
+    // copier of the tables and interned ids into a snapshot
+    void copyTo(SnapshotTables& tables) const;
+
+    // id interner and lookups, see DataStore
+    IdHandle internId(string_view id);
+    IdHandle findId(string_view id) const;
+    const string& idString(IdHandle id) const;
+    const deque<string>& ids() const { return idNames; }
+
+    // queries, see DataStore
+    const User* authenticateUser(const string& username, const string& password) const;
+    int getTeacherCount() const { return teacherCount; }
+    int getStudentCount() const { return studentCount; }
+    const User* getUserById(IdHandle userId) const;
+    const UserDetails* getUserDetails(IdHandle userId) const;
+    const Course* getCourseById(IdHandle courseId) const;
+    const vector<User>& getAllUsers() const { return users; }
+    const vector<Course>& getAllCourses() const { return courses; }
+
+    // mutators, see DataStore; assignTeacherToCourse returns whether the course exists
+    void addUser(const User& user, const UserDetails& details);
+    bool assignTeacherToCourse(IdHandle teacherId, IdHandle courseId);
+};
+
+//   enrollments and grades of the students whose handle maps to one shard (handle % shard count), with their
+//   indexes. Each shard is its own left-right pair with its own writer lock, so writes for students on different
+//   shards run in parallel; mutators take handles the caller interned through the Directory
+//
+//   a row keeps its slot for as long as it lives: a removed row is left as a tombstone (studentId NO_ID) and its
+//   slot goes to the next row added, so a stream resuming at a slot between two pins never skips or repeats a row
+class StudentShard {
+private:
     vector<Enrollment> enrollments;
     vector<Grade> grades;
-    string dataFile = "data.json";
+
+    // tombstoned slots of enrollments / grades, reused last freed first
+    vector<uint32_t> freeEnrollments;
+    vector<uint32_t> freeGrades;
+
+    // adjacency indexes from student / course handle to the slots of their rows, each list in ascending slot order
+    unordered_map<IdHandle, vector<uint32_t>> enrollmentsByStudent;
+    unordered_map<IdHandle, vector<uint32_t>> enrollmentsByCourse;
+    unordered_map<IdHandle, vector<uint32_t>> gradesByStudent;
+
+    // composite index from (student handle, course handle) to the slot of that grade in grades
+    unordered_map<uint64_t, uint32_t> gradeIndex;
+
+    // indexer for the enrollment at slot in both directions
+    void indexEnrollment(size_t slot);
+
+    // finder for the slot of a student's enrollment in a course, enrollments.size() if there is none
+    size_t findEnrollment(IdHandle studentId, IdHandle courseId) const;
+
+    // remover for the enrollment at slot, leaving a tombstone
+    void removeEnrollmentAt(size_t slot);
+
+    // key of a grade in gradeIndex
+    static uint64_t gradeKey(IdHandle studentId, IdHandle courseId) { return (uint64_t)studentId << 32 | courseId; }
 
 public:
-    DataStore();
-    
-    // data from JSON file
+    // loader for this shard's rows, replacing what was there; they are moved out of the arguments
+    void load(vector<Enrollment>& shardEnrollments, vector<Grade>& shardGrades);
+
+    // appender of this shard's rows to a snapshot
+    void copyTo(SnapshotTables& tables) const;
+
+    // queries, see DataStore
+    bool isEnrolled(IdHandle studentId, IdHandle courseId) const;
+    void forEachEnrolledCourse(IdHandle studentId, const function<void(IdHandle courseId)>& visit) const;
+    void forEachGradeOfStudent(IdHandle studentId, const function<void(const Grade&)>& visit) const;
+
+    // resumable visitors in slot order from slot on, until visit returns false; slot is left at the row after the
+    // last one visited, and false is returned once no row is left
+    bool forEachEnrolledStudentFrom(IdHandle courseId, size_t& slot, const function<bool(IdHandle studentId)>& visit) const;
+    bool forEachGradeFrom(size_t& slot, const function<bool(const Grade&)>& visit) const;
+
+    // mutators, see DataStore; the bool ones return whether anything changed
+    bool enrollStudent(IdHandle studentId, IdHandle courseId);
+    bool unenrollStudent(IdHandle studentId, IdHandle courseId);
+    void addOrUpdateGrade(IdHandle studentId, IdHandle courseId, int score, TextHandle note, IdHandle teacherId);
+    bool deleteGrade(IdHandle studentId, IdHandle courseId);
+};
+
+class DataStore {
+private:
+    string snapshotFile = "data.snap";
+    string dataFile = "data.json";     // JSON form, imported when there is no binary snapshot yet
+    string walFile = "data.wal";
+
+    // log every mutator appends one record to, replayed over the snapshot by loadData()
+    WriteAheadLog wal;
+    bool replaying = false;
+
+    // level a mutation is acknowledged at when its request does not pick one (DURABILITY, ENROLL_DURABILITY)
+    WriteAheadLog::Durability writeDurability = WriteAheadLog::SYNCED;
+    WriteAheadLog::Durability enrollmentDurability = WriteAheadLog::WRITTEN;
+
+    // serializer for saveData() calls, so snapshots cut, rotate and delete log segments one at a time
+    mutex snapshotLock;
+
+    // serializer for requests that read the directory and then change it, see writeLock()
+    mutex requestLock;
+
+    //   the tables: one directory and SHARDS student shards, each a left-right pair with its own writer lock.
+    //   Mutators lock only the pair they change, and never while the thread holds a ReadGuard
+    LeftRight<Directory> directory;
+    vector<unique_ptr<LeftRight<StudentShard>>> shards;
+
+    // shard holding a student's enrollments and grades
+    size_t shardOf(IdHandle studentId) const { return studentId % shards.size(); }
+
+    // copies the calling thread's ReadGuard pinned
+    const Directory& readDirectory() const;
+    const StudentShard& readShard(size_t shard) const;
+
+    // text of every record in both copies of every pair, append-only so readers resolve handles without a lock
+    shared_ptr<StringPool> strings;
+
+    // loader for both copies of the directory and of every shard from one snapshot, taking over its pool and
+    // moving its rows out
+    void adoptTables(SnapshotTables& tables);
+
+    // appender for one mutation record to the log, skipped while the log itself is being replayed
+    void logMutation(const json& record);
+
+    // applier for one logged mutation through the same mutator that logged it
+    void replayRecord(string_view payload);
+
+public:
+    explicit DataStore(const ServerConfig& config);
+
+    // most shards SHARDS may ask for, the size of a thread's pin set
+    static constexpr size_t MAX_SHARDS = 64;
+
+    //   pin of the calling thread to the published directory and every shard for as long as it lives; never
+    //   waits for a writer. Nested guards on one thread share the outermost pin
+    class ReadGuard {
+    public:
+        explicit ReadGuard(DataStore& store);
+        ~ReadGuard();
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+    private:
+        DataStore& store;
+    };
+
+    // pin for requests that only read, held until the response is built
+    ReadGuard readLock() { return ReadGuard(*this); }
+
+    // exclusive lock for requests that read the directory and then change it (signup derives the new id from the
+    // user counts), held until the response is built; enroll and grade writes skip it and only lock their
+    // student's shard, inside the mutators. Readers never wait for either
+    unique_lock<mutex> writeLock() { return unique_lock<mutex>(requestLock); }
+
+    // handle for an external id, interning it on first use
+    IdHandle internId(string_view id);
+
+    // handle for an external id, NO_ID if it was never interned
+    IdHandle findId(string_view id);
+
+    // string form of an id handle, for the JSON boundary; stays valid after the pin is released
+    const string& idString(IdHandle id);
+
+    // value of a record's text field, valid for the life of the store
+    string_view text(TextHandle handle) const { return strings->view(handle); }
+
+    // handle for a text value, for building a record to pass to a mutator
+    TextHandle internText(string_view value) { return strings->intern(value); }
+
+    // data from the binary snapshot (or data.json before the first one), then the log replayed on top
     void loadData();
-    
-    // data to JSON file
-    void saveData();
-    
+
+    // snapshot of every table to the binary snapshot file, replaced atomically, then deletion of the log segments it
+    // covers; holds every writer lock only while the tables are copied, readers never wait. False if it failed
+    bool saveData();
+
+    // bytes logged since the last snapshot, readable from any thread
+    uint64_t logBytes() const { return wal.size(); }
+
+    // sequence number of the last mutation the calling thread logged, read right after mutating
+    uint64_t logSequence();
+
+    // how far the log has written and synced mutations, never blocks; concurrent writers share one log flush
+    WriteAheadLog::Progress logProgress() { return wal.progress(); }
+
+    // checker whether the log broke, after which mutations are refused
+    bool logBroken() const { return wal.broken(); }
+
+    // registrar for an event loop's eventfd, signalled whenever logProgress() moves
+    void watchLog(int eventFd) { wal.watch(eventFd); }
+    void unwatchLog(int eventFd) { wal.unwatch(eventFd); }
+
+    // level mutations are acknowledged at by default, enrollment changes have their own
+    WriteAheadLog::Durability defaultDurability(bool enrollment) const {
+        return enrollment ? enrollmentDurability : writeDurability;
+    }
+
     // initializer with sample data
     void initializeDefaultData();
-    
-    // authenticator for user
-    User* authenticateUser(string username, string password);
-    
-    // adder for new user
-    void addUser(User user);
-    
+
+    // authenticator for user (caller holds readLock)
+    const User* authenticateUser(string username, string password);
+
+    // adder for new user from its two parts, its id interned with internId()
+    void addUser(const User& user, const UserDetails& details);
+
     // counter for teachers
     int getTeacherCount();
-    
+
     // counter for students
     int getStudentCount();
-    
+
     // assigner for teacher to course
     void assignTeacherToCourse(string teacherId, string courseId);
-    
+
     // enroller for student in course
     void enrollStudent(string studentId, string courseId);
-    
-    //  get user by ID
-    User* getUserById(string userId);
-    
-    // all students
-    vector<User> getAllStudents();
-    
-    // grades for a student
-    vector<Grade> getGradesByStudent(string studentId);
-    
-    // all courses
-    vector<Course> getAllCourses();
-    
-    //  get course by ID
-    Course* getCourseById(string courseId);
-    
-    // courses for a specific teacher
-    vector<Course> getCoursesByTeacher(string teacherId);
-    
-    // enrolled courses for a student
-    vector<Course> getEnrolledCourses(string studentId);
-    
+
+    //  get user by ID (caller holds readLock)
+    const User* getUserById(string userId);
+    const User* getUserById(IdHandle userId);
+
+    // cold part of a user, for the rare request that needs more than User holds (caller holds readLock)
+    const UserDetails* getUserDetails(IdHandle userId);
+
+    // visitors over const records in table order, nothing is copied; a record is only valid during its visit, and a
+    // visit must not mutate the store (runs under the caller's readLock, or pins for its own length)
+    //   every course
+    void forEachCourse(const function<void(const Course&)>& visit);
+
+    //   courses a student is enrolled in, from the student's shard
+    void forEachEnrolledCourse(string_view studentId, const function<void(const Course&)>& visit);
+
+    //   grades of a student, from the student's shard
+    void forEachGradeOfStudent(string_view studentId, const function<void(const Grade&)>& visit);
+
+    //   position of a resumable visitor: the shard it is in and the slot it continues at. Users are never removed
+    //   and shard rows never change slot, so a visit split over many pins still sees every record that exists
+    //   throughout exactly once; records added or removed in between may or may not be seen
+    struct Cursor {
+        size_t shard = 0;
+        size_t slot = 0;
+    };
+
+    // resumable visitors for streamed lists, pinning only for the call: each visits from cursor on until visit
+    // returns false, leaves cursor at the next record and returns true, or false once every record was visited
+    //   every student
+    bool forEachStudentFrom(Cursor& cursor, const function<bool(const User&)>& visit);
+
+    //   students enrolled in a course, shard after shard
+    bool forEachStudentInCourseFrom(string_view courseId, Cursor& cursor, const function<bool(const User&)>& visit);
+
+    //   grades a teacher gave, shard after shard
+    bool forEachGradeOfTeacherFrom(string_view teacherId, Cursor& cursor, const function<bool(const Grade&)>& visit);
+
+    //  get course by ID (caller holds readLock)
+    const Course* getCourseById(string courseId);
+    const Course* getCourseById(IdHandle courseId);
+
     // checker if student is enrolled in a course
     bool isEnrolled(string studentId, string courseId);
-    
+
     // unenroll for student from a course
     void unenrollStudent(string studentId, string courseId);
-    
-    // students enrolled in a course
-    vector<User> getStudentsByCourse(string courseId);
-    
-    // all grades (for teacher)
-    vector<Grade> getAllGrades();
-    
-    // grades for a teacher's courses
-    vector<Grade> getGradesByTeacher(string teacherId);
-    
+
     // adding or updating grade
     void addOrUpdateGrade(string studentId, string courseId, int score, string note, string teacherId);
-    
+
     // deleting grade
     void deleteGrade(string studentId, string courseId);
 };
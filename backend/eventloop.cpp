@@ -0,0 +1,318 @@
+#include "eventloop.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+//   max events drained per epoll_wait call
+static const int MAX_EVENTS = 256;
+
+//   size of the stack buffer used for each read
+static const size_t READ_CHUNK = 16384;
+
+//   iovecs gathered per sendmsg call (16 pipelined responses)
+static const int MAX_IOVECS = 16 * HTTP_RESPONSE_SEGMENTS;
+
+//   setter for O_NONBLOCK on a socket
+static bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+EventLoop::EventLoop(DataStore& store, int listenFd, const ServerConfig& config, AdmissionControl& admission)
+    : store(store), config(config), admission(admission), listenSocket(listenFd),
+      timers(CONNECTION_TIMER_TICK, chrono::steady_clock::now()) {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        cerr << "Error creating epoll instance" << endl;
+        return;
+    }
+
+    setNonBlocking(listenSocket);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = listenSocket;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenSocket, &ev);
+
+    //   held acknowledgements are released from the loop when the log flusher signals progress
+    commitFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (commitFd < 0) {
+        cerr << "Error creating eventfd" << endl;
+        close(epollFd);
+        epollFd = -1;
+        return;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = commitFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, commitFd, &ev);
+    store.watchLog(commitFd);
+}
+
+EventLoop::~EventLoop() {
+    for (auto& entry : connections) {
+        close(entry.first);
+    }
+    if (commitFd >= 0) {
+        store.unwatchLog(commitFd);
+        close(commitFd);
+    }
+    if (epollFd >= 0) {
+        close(epollFd);
+    }
+}
+
+//   runner for the reactor, returns only on a fatal epoll error
+void EventLoop::run() {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (epollFd >= 0) {
+        //   with no deadline pending there is nothing to wake up for, with reads to resume there is no waiting
+        int timeout = timers.empty() ? -1 : (int)timers.tickLength().count();
+        if (!inputResumed.empty()) {
+            timeout = 0;
+        }
+        int ready = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            cerr << "Error waiting on epoll" << endl;
+            return;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listenSocket) {
+                acceptConnections();
+                continue;
+            }
+            if (fd == commitFd) {
+                eventfd_t signals;
+                eventfd_read(commitFd, &signals);
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            Connection& conn = *it->second;
+
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                handleReadable(conn);
+            }
+            if (conn.state() == Connection::WRITING && (events[i].events & EPOLLOUT)) {
+                handleWritable(conn);
+            }
+            if (conn.state() == Connection::CLOSING) {
+                closeConnection(fd);
+            } else {
+                updateDeadline(conn);
+            }
+        }
+
+        releaseCommitted();
+        resumeInput();
+        reapExpiredConnections();
+    }
+}
+
+//   acceptor for every pending connection on the listening socket
+void EventLoop::acceptConnections() {
+    while (true) {
+        struct sockaddr_in clientAddr;
+        socklen_t clientLen = sizeof(clientAddr);
+        int clientSocket = accept4(listenSocket, (struct sockaddr*)&clientAddr, &clientLen,
+                                   SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSocket < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                cerr << "Error accepting connection" << endl;
+            }
+            return;
+        }
+        if (!admission.admit()) {
+            shedConnection(clientSocket);
+            continue;
+        }
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = clientSocket;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientSocket, &ev) < 0) {
+            close(clientSocket);
+            admission.release();
+            continue;
+        }
+        auto conn = make_unique<Connection>(clientSocket, config.maxRequestsPerConnection, config.maxBodyBytes);
+        conn->timer().key = clientSocket;
+        updateDeadline(*conn);
+        connections[clientSocket] = move(conn);
+    }
+}
+
+//   answerer for a connection refused by admission control, writes the 503 and closes it
+void EventLoop::shedConnection(int fd) {
+    //   a fresh socket's send buffer always has room for the short response, so one attempt is enough
+    string_view response = admission.overloadResponse();
+    send(fd, response.data(), response.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(fd);
+}
+
+//   reader for available bytes until EAGAIN or until the connection stops taking input; each chunk is parsed as it
+//   arrives, so a client that pipelines without reading is no longer read once its responses back up, and the rest
+//   stays in the socket (its window closes) until handleWritable() drains them and resumes reading
+void EventLoop::handleReadable(Connection& conn) {
+    char buffer[READ_CHUNK];
+
+    while (conn.wantsInput()) {
+        ssize_t bytesRead = read(conn.fd(), buffer, sizeof(buffer));
+        if (bytesRead > 0) {
+            conn.appendInput(buffer, bytesRead);
+            conn.processInput(store);
+            continue;
+        }
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+        //   a peer that half-closed still gets responses to what it already sent, the last one announcing the close
+        conn.markPeerClosed();
+        conn.processInput(store);
+        break;
+    }
+    if (conn.state() == Connection::WRITING) {
+        handleWritable(conn);
+    }
+}
+
+//   writer for queued response bytes until EAGAIN
+void EventLoop::handleWritable(Connection& conn) {
+    struct iovec iov[MAX_IOVECS];
+    bool inputPaused = !conn.wantsInput();
+
+    while (conn.pendingOutputSize() > 0) {
+        //   acknowledgements of mutations wait until the flusher has the group commit they ride on durable
+        if (conn.awaitingLog()) {
+            awaitingCommit.push_back(conn.fd());
+            return;
+        }
+
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = conn.gatherOutput(iov, MAX_IOVECS);
+        ssize_t written = sendmsg(conn.fd(), &msg, MSG_NOSIGNAL);
+        if (written > 0) {
+            conn.consumeOutput(written);
+
+            //   pipelined requests held back by a full output buffer resume once it drains
+            if (conn.state() == Connection::READING) {
+                conn.processInput(store);
+            }
+
+            //   input that arrived while reading was paused raises no new edge, so it is read at the end of the
+            //   iteration
+            if (inputPaused && conn.wantsInput()) {
+                inputResumed.push_back(conn.fd());
+                inputPaused = false;
+            }
+            continue;
+        }
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        conn.markClosing();
+        return;
+    }
+}
+
+//   closer for a client socket and its state
+void EventLoop::closeConnection(int fd) {
+    auto it = connections.find(fd);
+    if (it != connections.end()) {
+        timers.cancel(it->second->timer());
+        connections.erase(it);
+        admission.release();
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+}
+
+//   rescheduler for the connection's timer on its current deadline
+void EventLoop::updateDeadline(Connection& conn) {
+    Connection::Deadline deadline = conn.deadline(config);
+    if (deadline.armed) {
+        timers.schedule(conn.timer(), deadline.at);
+    } else {
+        timers.cancel(conn.timer());
+    }
+}
+
+//   closer for every connection whose deadline passed, counting each by reason
+void EventLoop::reapExpiredConnections() {
+    auto now = chrono::steady_clock::now();
+    expired.clear();
+    timers.advance(now, expired);
+
+    for (uint64_t key : expired) {
+        auto it = connections.find((int)key);
+        if (it == connections.end()) continue;
+
+        //   deadlines beyond the wheel's span fire early and are simply put back
+        Connection::Deadline deadline = it->second->deadline(config);
+        if (!deadline.armed) continue;
+        if (deadline.at > now) {
+            timers.schedule(it->second->timer(), deadline.at);
+            continue;
+        }
+        countMetric(serverMetrics().connectionsReaped[deadline.reason]);
+        closeConnection((int)key);
+    }
+}
+
+//   sender for output held for the write-ahead log: every held connection whose records the flusher has reached
+//   is written, the rest stay held until its next signal on commitFd; pipelined requests answered meanwhile may
+//   hold a connection again
+void EventLoop::releaseCommitted() {
+    if (awaitingCommit.empty()) return;
+    WriteAheadLog::Progress progress = store.logProgress();
+
+    //   a connection held again by several events of one iteration is listed once
+    sort(awaitingCommit.begin(), awaitingCommit.end());
+    awaitingCommit.erase(unique(awaitingCommit.begin(), awaitingCommit.end()), awaitingCommit.end());
+
+    releasing.swap(awaitingCommit);
+    for (int fd : releasing) {
+        auto it = connections.find(fd);
+        if (it == connections.end()) continue;
+        Connection& conn = *it->second;
+        conn.commitReached(progress);
+        handleWritable(conn);
+        if (conn.state() == Connection::CLOSING) {
+            closeConnection(fd);
+        } else {
+            updateDeadline(conn);
+        }
+    }
+    releasing.clear();
+}
+
+//   reader for connections whose backed-up output drained during this iteration; each is read once, and one that
+//   backs up and drains again meanwhile is listed for the next iteration, which then does not wait on epoll
+void EventLoop::resumeInput() {
+    if (inputResumed.empty()) return;
+
+    resuming.swap(inputResumed);
+    for (int fd : resuming) {
+        auto it = connections.find(fd);
+        if (it == connections.end()) continue;
+        Connection& conn = *it->second;
+        handleReadable(conn);
+        if (conn.state() == Connection::CLOSING) {
+            closeConnection(fd);
+        } else {
+            updateDeadline(conn);
+        }
+    }
+    resuming.clear();
+}
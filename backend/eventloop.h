@@ -0,0 +1,68 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "connection.h"
+#include "datastore.h"
+#include "config.h"
+#include "admission.h"
+#include "timerwheel.h"
+
+using namespace std;
+
+//   event loop section - edge-triggered epoll reactor multiplexing all client connections on one thread
+
+class EventLoop {
+public:
+    EventLoop(DataStore& store, int listenFd, const ServerConfig& config, AdmissionControl& admission);
+    ~EventLoop();
+
+    // runner for the reactor, returns only on a fatal epoll error
+    void run();
+
+private:
+    // acceptor for every pending connection on the listening socket
+    void acceptConnections();
+
+    // answerer for a connection refused by admission control, writes the 503 and closes it
+    void shedConnection(int fd);
+
+    // reader for available bytes until EAGAIN or until the connection stops taking input
+    void handleReadable(Connection& conn);
+
+    // writer for queued response bytes until EAGAIN
+    void handleWritable(Connection& conn);
+
+    // closer for a client socket and its state
+    void closeConnection(int fd);
+
+    // rescheduler for the connection's timer on its current deadline
+    void updateDeadline(Connection& conn);
+
+    // closer for every connection whose deadline passed, counting each by reason
+    void reapExpiredConnections();
+
+    // sender for output held for the write-ahead log whose records the flusher has reached, never waits for it
+    void releaseCommitted();
+
+    // reader for connections whose backed-up output drained during this iteration
+    void resumeInput();
+
+    DataStore& store;
+    const ServerConfig& config;
+    AdmissionControl& admission;
+    int listenSocket;
+    int epollFd;
+    int commitFd = -1;          // eventfd the log flusher signals on progress
+    unordered_map<int, unique_ptr<Connection>> connections;
+    TimerWheel timers;
+    vector<uint64_t> expired;   // reused by reapExpiredConnections()
+    vector<int> awaitingCommit; // connections whose output waits for the log, checked once per iteration
+    vector<int> releasing;      // reused by releaseCommitted()
+    vector<int> inputResumed;   // connections to read again at the end of the iteration
+    vector<int> resuming;       // reused by resumeInput()
+};
+
+#endif // EVENTLOOP_H
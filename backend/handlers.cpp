@@ -1,10 +1,60 @@
 #include "handlers.h"
+#include "metrics.h"
 #include <sstream>
 #include <iomanip>
 #include <ctime>
+#include <functional>
+
+//   streamed JSON array section - large collections are serialized chunk by chunk while the socket drains
+
+//   JSON array body rendered straight from the store: each chunk pins the tables only while it renders and resumes
+//   at a DataStore::Cursor, so nothing but the chunk is held however long the list is, and every row present for
+//   the whole response goes out exactly once
+class JsonArrayStream : public ResponseStream {
+public:
+    //   taker of one rendered row, false once the chunk is full
+    using RowSink = function<bool(const json& row)>;
+
+    //   producer for the rows from cursor on, handing each to emit; false once none is left
+    using Producer = function<bool(DataStore& store, DataStore::Cursor& cursor, const RowSink& emit)>;
+
+    JsonArrayStream(DataStore& store, Producer produce) : store(store), produce(move(produce)) {}
+
+    bool next(string& out) override {
+        auto guard = store.readLock();
+        size_t limit = out.size() + HTTP_STREAM_CHUNK_BYTES;
+        if (!opened) {
+            out += '[';
+            opened = true;
+        }
+
+        bool more = produce(store, cursor, [&](const json& row) {
+            if (!empty) out += ',';
+            empty = false;
+            out += row.dump();
+            return out.size() < limit;
+        });
+        if (!more) {
+            out += ']';
+        }
+        return more;
+    }
+
+private:
+    DataStore& store;
+    Producer produce;
+    DataStore::Cursor cursor;
+    bool opened = false;
+    bool empty = true;
+};
+
+//   builder for a 200 response streaming the rows produce renders as a JSON array
+static HttpResponse streamJsonArray(DataStore& store, JsonArrayStream::Producer produce) {
+    return buildStreamingResponse(200, "OK", make_unique<JsonArrayStream>(store, move(produce)));
+}
 
 // handler for user login authentication
-string handleLogin(DataStore& store, string body) {
+HttpResponse handleLogin(DataStore& store, string_view body) {
     // Validate body is not empty
     if (body.empty()) {
         json errorResponse;
@@ -43,15 +93,15 @@ string handleLogin(DataStore& store, string body) {
     string username = requestData["username"];
     string password = requestData["password"];
     
-    User* user = store.authenticateUser(username, password);
+    const User* user = store.authenticateUser(username, password);
     
     if (user != nullptr) {
         json response;
         response["success"] = true;
         response["user"] = {
-            {"id", user->id},
-            {"username", user->username},
-            {"role", user->role}
+            {"id", store.idString(user->id)},
+            {"username", store.text(user->username)},
+            {"role", store.text(store.getUserDetails(user->id)->roleName)}
         };
         return buildHttpResponse(200, "OK", response.dump());
     } else {
@@ -63,7 +113,7 @@ string handleLogin(DataStore& store, string body) {
 }
 
 // handler for user signup
-string handleSignup(DataStore& store, string body) {
+HttpResponse handleSignup(DataStore& store, string_view body) {
     // Validate body is not empty
     if (body.empty()) {
         json errorResponse;
@@ -149,18 +199,20 @@ string handleSignup(DataStore& store, string body) {
     
     // creator for new user
     User newUser;
-    newUser.id = userId;
-    newUser.username = username;
-    newUser.password = password;
-    newUser.role = role;
-    newUser.name = firstName + " " + lastName;
-    newUser.firstName = firstName;
-    newUser.lastName = lastName;
-    newUser.dateOfBirth = dateOfBirth;
-    newUser.email = email;
+    newUser.id = store.internId(userId);
+    newUser.role = roleFromName(role);
+    newUser.username = store.internText(username);
+    newUser.name = store.internText(firstName + " " + lastName);
+    UserDetails newDetails;
+    newDetails.password = store.internText(password);
+    newDetails.roleName = store.internText(role);
+    newDetails.firstName = store.internText(firstName);
+    newDetails.lastName = store.internText(lastName);
+    newDetails.dateOfBirth = store.internText(dateOfBirth);
+    newDetails.email = store.internText(email);
     
     // adder for user to datastore
-    store.addUser(newUser);
+    store.addUser(newUser, newDetails);
     
     // handler for course assignment/enrollment
     if (requestData.contains("courseId") && !requestData["courseId"].is_null()) {
@@ -183,69 +235,65 @@ string handleSignup(DataStore& store, string body) {
     json response;
     response["success"] = true;
     response["user"] = {
-        {"id", newUser.id},
-        {"username", newUser.username},
-        {"role", newUser.role}
+        {"id", userId},
+        {"username", username},
+        {"role", role}
     };
     
     return buildHttpResponse(201, "Created", response.dump());
 }
 
-//  get list of all students
-string handleGetStudents(DataStore& store) {
-    vector<User> students = store.getAllStudents();
-    json response = json::array();
-    
-    for (auto& student : students) {
-        json studentObj;
-        studentObj["id"] = student.id;
-        studentObj["username"] = student.username;
-        response.push_back(studentObj);
-    }
-    
-    return buildHttpResponse(200, "OK", response.dump());
+//  get list of all students (streamed)
+HttpResponse handleGetStudents(DataStore& store) {
+    return streamJsonArray(store, [](DataStore& store, DataStore::Cursor& cursor, const JsonArrayStream::RowSink& emit) {
+        return store.forEachStudentFrom(cursor, [&](const User& student) {
+            json studentObj;
+            studentObj["id"] = store.idString(student.id);
+            studentObj["username"] = store.text(student.username);
+            return emit(studentObj);
+        });
+    });
 }
 
 //  get all courses
-string handleGetCourses(DataStore& store) {
-    vector<Course> courses = store.getAllCourses();
+HttpResponse handleGetCourses(DataStore& store) {
     json response = json::array();
     
-    for (auto& course : courses) {
-        User* teacher = store.getUserById(course.teacherId);
+    //   rows are built straight from the pinned records, no copy of the table is taken
+    store.forEachCourse([&](const Course& course) {
+        const User* teacher = store.getUserById(course.teacherId);
         json courseObj;
-        courseObj["id"] = course.id;
-        courseObj["name"] = course.name;
-        courseObj["teacherId"] = course.teacherId;
-        courseObj["teacherName"] = teacher ? teacher->username : "Unknown";
-        courseObj["description"] = course.description;
+        courseObj["id"] = store.idString(course.id);
+        courseObj["name"] = store.text(course.name);
+        courseObj["teacherId"] = store.idString(course.teacherId);
+        courseObj["teacherName"] = teacher ? store.text(teacher->username) : "Unknown";
+        courseObj["description"] = store.text(course.description);
         response.push_back(courseObj);
-    }
+    });
     
     return buildHttpResponse(200, "OK", response.dump());
 }
 
 //    get enrolled courses for a student
-string handleGetStudentCourses(DataStore& store, string studentId) {
-    vector<Course> courses = store.getEnrolledCourses(studentId);
+HttpResponse handleGetStudentCourses(DataStore& store, string studentId) {
     json response = json::array();
     
-    for (auto& course : courses) {
-        User* teacher = store.getUserById(course.teacherId);
+    store.forEachEnrolledCourse(studentId, [&](const Course& course) {
+        const User* teacher = store.getUserById(course.teacherId);
         json courseObj;
-        courseObj["id"] = course.id;
-        courseObj["name"] = course.name;
-        courseObj["teacherId"] = course.teacherId;
-        courseObj["teacherName"] = teacher ? teacher->username : "Unknown";
-        courseObj["description"] = course.description;
+        courseObj["id"] = store.idString(course.id);
+        courseObj["name"] = store.text(course.name);
+        courseObj["teacherId"] = store.idString(course.teacherId);
+        courseObj["teacherName"] = teacher ? store.text(teacher->username) : "Unknown";
+        courseObj["description"] = store.text(course.description);
         response.push_back(courseObj);
-    }
+    });
     
     return buildHttpResponse(200, "OK", response.dump());
 }
 
 //   enroller for student in a course
-string handleEnrollCourse(DataStore& store, string body) {
+HttpResponse handleEnrollCourse(DataStore& store, string_view body) {
     json requestData = json::parse(body);
     string studentId = requestData["studentId"];
     string courseId = requestData["courseId"];
@@ -259,7 +307,7 @@ string handleEnrollCourse(DataStore& store, string body) {
 }
 
 //   unenroller for student from a course
-string handleUnenrollCourse(DataStore& store, string body) {
+HttpResponse handleUnenrollCourse(DataStore& store, string_view body) {
     json requestData = json::parse(body);
     string studentId = requestData["studentId"];
     string courseId = requestData["courseId"];
@@ -272,66 +320,61 @@ string handleUnenrollCourse(DataStore& store, string body) {
     return buildHttpResponse(200, "OK", response.dump());
 }
 
-//  get all grades for teacher view (for their courses)
-string handleGetTeacherGrades(DataStore& store, string teacherId) {
-    vector<Grade> grades = store.getGradesByTeacher(teacherId);
-    json response = json::array();
-    
-    for (auto& grade : grades) {
-        User* student = store.getUserById(grade.studentId);
-        Course* course = store.getCourseById(grade.courseId);
-        json gradeObj;
-        gradeObj["studentId"] = grade.studentId;
-        gradeObj["studentName"] = student ? student->name : "Unknown";
-        gradeObj["courseId"] = grade.courseId;
-        gradeObj["courseName"] = course ? course->name : "Unknown";
-        gradeObj["score"] = grade.score;
-        gradeObj["note"] = grade.note;
-        gradeObj["teacherId"] = grade.teacherId;
-        response.push_back(gradeObj);
-    }
-    
-    return buildHttpResponse(200, "OK", response.dump());
+//  get all grades for teacher view (for their courses, streamed)
+HttpResponse handleGetTeacherGrades(DataStore& store, string teacherId) {
+    return streamJsonArray(store, [teacherId](DataStore& store, DataStore::Cursor& cursor,
+                                              const JsonArrayStream::RowSink& emit) {
+        return store.forEachGradeOfTeacherFrom(teacherId, cursor, [&](const Grade& grade) {
+            const User* student = store.getUserById(grade.studentId);
+            const Course* course = store.getCourseById(grade.courseId);
+            json gradeObj;
+            gradeObj["studentId"] = store.idString(grade.studentId);
+            gradeObj["studentName"] = student ? store.text(student->name) : "Unknown";
+            gradeObj["courseId"] = store.idString(grade.courseId);
+            gradeObj["courseName"] = course ? store.text(course->name) : "Unknown";
+            gradeObj["score"] = grade.score;
+            gradeObj["note"] = store.text(grade.note);
+            gradeObj["teacherId"] = store.idString(grade.teacherId);
+            return emit(gradeObj);
+        });
+    });
 }
 
 //    get grades for a specific student with course info
-string handleGetStudentGrades(DataStore& store, string studentId) {
-    vector<Grade> grades = store.getGradesByStudent(studentId);
+HttpResponse handleGetStudentGrades(DataStore& store, string studentId) {
     json response = json::array();
     
-    for (auto& grade : grades) {
-        Course* course = store.getCourseById(grade.courseId);
+    store.forEachGradeOfStudent(studentId, [&](const Grade& grade) {
+        const Course* course = store.getCourseById(grade.courseId);
         json gradeObj;
-        gradeObj["courseId"] = grade.courseId;
-        gradeObj["courseName"] = course ? course->name : "Unknown";
+        gradeObj["courseId"] = store.idString(grade.courseId);
+        gradeObj["courseName"] = course ? store.text(course->name) : "Unknown";
         gradeObj["score"] = grade.score;
-        gradeObj["note"] = grade.note;
-        gradeObj["teacherId"] = grade.teacherId;
+        gradeObj["note"] = store.text(grade.note);
+        gradeObj["teacherId"] = store.idString(grade.teacherId);
         response.push_back(gradeObj);
-    }
+    });
     
     return buildHttpResponse(200, "OK", response.dump());
 }
 
-//    get enrolled students for a specific course
-string handleGetCourseStudents(DataStore& store, string courseId) {
-    vector<User> students = store.getStudentsByCourse(courseId);
-    json response = json::array();
-    
-    for (auto& student : students) {
-        json studentObj;
-        studentObj["id"] = student.id;
-        studentObj["username"] = student.username;
-        studentObj["name"] = student.name;
-        studentObj["role"] = student.role;
-        response.push_back(studentObj);
-    }
-    
-    return buildHttpResponse(200, "OK", response.dump());
+//    get enrolled students for a specific course (streamed)
+HttpResponse handleGetCourseStudents(DataStore& store, string courseId) {
+    return streamJsonArray(store, [courseId](DataStore& store, DataStore::Cursor& cursor,
+                                             const JsonArrayStream::RowSink& emit) {
+        return store.forEachStudentInCourseFrom(courseId, cursor, [&](const User& student) {
+            json studentObj;
+            studentObj["id"] = store.idString(student.id);
+            studentObj["username"] = store.text(student.username);
+            studentObj["name"] = store.text(student.name);
+            studentObj["role"] = "student";
+            return emit(studentObj);
+        });
+    });
 }
 
 //   adder or updater for a grade
-string handleAddGrade(DataStore& store, string body) {
+HttpResponse handleAddGrade(DataStore& store, string_view body) {
     json requestData = json::parse(body);
     string studentId = requestData["studentId"];
     string courseId = requestData["courseId"];
@@ -356,7 +399,7 @@ string handleAddGrade(DataStore& store, string body) {
 }
 
 // to be able to delete a grade
-string handleDeleteGrade(DataStore& store, string body) {
+HttpResponse handleDeleteGrade(DataStore& store, string_view body) {
     json requestData = json::parse(body);
     string studentId = requestData["studentId"];
     string courseId = requestData["courseId"];
@@ -368,3 +411,25 @@ string handleDeleteGrade(DataStore& store, string body) {
     response["message"] = "Grade deleted successfully";
     return buildHttpResponse(200, "OK", response.dump());
 }
+
+//   get server counters
+HttpResponse handleGetMetrics() {
+    ServerMetrics& metrics = serverMetrics();
+    json reaped = json::object();
+    for (int reason = 0; reason < REAP_REASONS; reason++) {
+        reaped[reapReasonName((ReapReason)reason)] = metrics.connectionsReaped[reason].load(memory_order_relaxed);
+    }
+
+    json response;
+    response["connections"]["accepted"] = metrics.connectionsAccepted.load(memory_order_relaxed);
+    response["connections"]["open"] = metrics.connectionsOpen.load(memory_order_relaxed);
+    response["connections"]["shed"] = metrics.connectionsShed.load(memory_order_relaxed);
+    response["connections"]["reaped"] = reaped;
+    response["storage"]["snapshots"] = metrics.snapshotsWritten.load(memory_order_relaxed);
+    response["storage"]["snapshotFailures"] = metrics.snapshotFailures.load(memory_order_relaxed);
+    response["storage"]["walBatches"] = metrics.walBatches.load(memory_order_relaxed);
+    response["storage"]["walRecords"] = metrics.walRecords.load(memory_order_relaxed);
+    response["storage"]["textBytes"] = metrics.textBytes.load(memory_order_relaxed);
+    response["storage"]["snapshotTextBytes"] = metrics.snapshotTextBytes.load(memory_order_relaxed);
+    return buildHttpResponse(200, "OK", response.dump());
+}
@@ -12,39 +12,42 @@ using namespace std;
 //   API handlers section - handle specific API endpoints
 
 // login authentication
-string handleLogin(DataStore& store, string body);
+HttpResponse handleLogin(DataStore& store, string_view body);
 
 // signup new user
-string handleSignup(DataStore& store, string body);
+HttpResponse handleSignup(DataStore& store, string_view body);
 
 // list of all students
-string handleGetStudents(DataStore& store);
+HttpResponse handleGetStudents(DataStore& store);
 
 // all courses
-string handleGetCourses(DataStore& store);
+HttpResponse handleGetCourses(DataStore& store);
 
 // enrolled courses for a student
-string handleGetStudentCourses(DataStore& store, string studentId);
+HttpResponse handleGetStudentCourses(DataStore& store, string studentId);
 
 // enroll for student in a course
-string handleEnrollCourse(DataStore& store, string body);
+HttpResponse handleEnrollCourse(DataStore& store, string_view body);
 
 // unenroll for student from a course
-string handleUnenrollCourse(DataStore& store, string body);
+HttpResponse handleUnenrollCourse(DataStore& store, string_view body);
 
 // grades for all courses for teacher view
-string handleGetTeacherGrades(DataStore& store, string teacherId);
+HttpResponse handleGetTeacherGrades(DataStore& store, string teacherId);
 
 // grades for a specific student with course info
-string handleGetStudentGrades(DataStore& store, string studentId);
+HttpResponse handleGetStudentGrades(DataStore& store, string studentId);
 
 // enrolled students for a specific course
-string handleGetCourseStudents(DataStore& store, string courseId);
+HttpResponse handleGetCourseStudents(DataStore& store, string courseId);
 
 // adding or updating a grade
-string handleAddGrade(DataStore& store, string body);
+HttpResponse handleAddGrade(DataStore& store, string_view body);
 
 // deleting a grade
-string handleDeleteGrade(DataStore& store, string body);
+HttpResponse handleDeleteGrade(DataStore& store, string_view body);
+
+// server counters (connections accepted, open, shed and reaped per deadline)
+HttpResponse handleGetMetrics();
 
 #endif // HANDLERS_H
@@ -1,48 +1,312 @@
 #include "http.h"
+#include <cctype>
+#include <cstdio>
 
-// parser for HTTP request string into structured data
-HttpRequest parseHttpRequest(string requestStr) {
-    HttpRequest req;
-    istringstream stream(requestStr);
-    string line;
-    
-    //   parser for request line
-    getline(stream, line);
-    istringstream requestLine(line);
-    requestLine >> req.method >> req.path;
-    
-    //   parser for headers
-    while (getline(stream, line) && line != "\r" && !line.empty()) {
-        size_t colonPos = line.find(':');
-        if (colonPos != string::npos) {
-            string key = line.substr(0, colonPos);
-            string value = line.substr(colonPos + 2);
-            if (value.back() == '\r') value.pop_back();
-            req.headers[key] = value;
-        }
-    }
-    
-    //   parser for body
-    string bodyContent;
-    while (getline(stream, line)) {
-        bodyContent += line;
-    }
-    req.body = bodyContent;
-    
-    return req;
-}
-
-//   builder for formatted HTTP response
-string buildHttpResponse(int statusCode, string statusText, string body, string contentType) {
-    ostringstream response;
-    response << "HTTP/1.1 " << statusCode << " " << statusText << "\r\n";
-    response << "Content-Type: " << contentType << "\r\n";
-    response << "Content-Length: " << body.length() << "\r\n";
-    response << "Access-Control-Allow-Origin: *\r\n";
-    response << "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n";
-    response << "Access-Control-Allow-Headers: Content-Type, Authorization\r\n";
-    response << "Connection: close\r\n";
-    response << "\r\n";
-    response << body;
-    return response.str();
+//   comparer for two strings ignoring ASCII case
+static bool equalsIgnoreCase(string_view a, string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+    }
+    return true;
+}
+
+//   trimmer for leading and trailing spaces and tabs
+static string_view trimWhitespace(string_view value) {
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+    return value;
+}
+
+//   finder for a header value by case-insensitive name, empty if absent
+string_view HttpRequest::header(string_view name) const {
+    for (size_t i = 0; i < headerCount; i++) {
+        if (equalsIgnoreCase(headers[i].name, name)) {
+            return headers[i].value;
+        }
+    }
+    return string_view();
+}
+
+//   resetter for the next request on the same connection
+void HttpParser::reset() {
+    size_t limit = maxBodySize;
+    *this = HttpParser();
+    maxBodySize = limit;
+}
+
+//   setter for the error state
+HttpParser::Status HttpParser::fail(int status, const char* reason) {
+    errorCode = status;
+    errorText = reason;
+    return ERROR;
+}
+
+//   parser for the request line ending at lineEnd
+bool HttpParser::parseRequestLine(string_view buffer, size_t lineEnd) {
+    string_view line = buffer.substr(lineStart, lineEnd - lineStart);
+    size_t firstSpace = line.find(' ');
+    size_t lastSpace = line.rfind(' ');
+    if (firstSpace == string_view::npos || firstSpace == 0 || lastSpace == firstSpace ||
+        lastSpace + 1 == line.size() || lastSpace == firstSpace + 1) {
+        fail(400, "Bad Request");
+        return false;
+    }
+
+    method = {lineStart, firstSpace};
+    path = {lineStart + firstSpace + 1, lastSpace - firstSpace - 1};
+    version = {lineStart + lastSpace + 1, line.size() - lastSpace - 1};
+
+    if (buffer.substr(version.offset, version.length).substr(0, 7) != "HTTP/1.") {
+        fail(505, "HTTP Version Not Supported");
+        return false;
+    }
+    return true;
+}
+
+//   parser for one header line ending at lineEnd
+bool HttpParser::parseHeaderLine(string_view buffer, size_t lineEnd) {
+    string_view line = buffer.substr(lineStart, lineEnd - lineStart);
+
+    //   obsolete line folding and nameless headers are both rejected
+    size_t colonPos = line.find(':');
+    if (line.front() == ' ' || line.front() == '\t' || colonPos == string_view::npos || colonPos == 0) {
+        fail(400, "Bad Request");
+        return false;
+    }
+    if (headerCount == MAX_HTTP_HEADERS) {
+        fail(431, "Request Header Fields Too Large");
+        return false;
+    }
+
+    string_view name = line.substr(0, colonPos);
+    string_view value = trimWhitespace(line.substr(colonPos + 1));
+    headerNames[headerCount] = {lineStart, name.size()};
+    headerValues[headerCount] = {value.empty() ? lineEnd : (size_t)(value.data() - buffer.data()), value.size()};
+    headerCount++;
+
+    if (equalsIgnoreCase(name, "Content-Length")) {
+        if (value.empty() || value.size() > 18) {
+            fail(400, "Bad Request");
+            return false;
+        }
+        size_t parsed = 0;
+        for (char c : value) {
+            if (c < '0' || c > '9') {
+                fail(400, "Bad Request");
+                return false;
+            }
+            parsed = parsed * 10 + (c - '0');
+        }
+        if (sawContentLength && parsed != contentLength) {
+            fail(400, "Bad Request");
+            return false;
+        }
+
+        //   refused before any of the body is read or buffered
+        if (parsed > maxBodySize) {
+            fail(413, "Payload Too Large");
+            return false;
+        }
+        sawContentLength = true;
+        contentLength = parsed;
+    } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+        fail(501, "Not Implemented");
+        return false;
+    } else if (equalsIgnoreCase(name, "Expect")) {
+        if (!equalsIgnoreCase(value, "100-continue")) {
+            fail(417, "Expectation Failed");
+            return false;
+        }
+        expectContinue = buffer.substr(version.offset, version.length) == "HTTP/1.1";
+    }
+    return true;
+}
+
+//   parser for the buffered bytes of the current request, resumes where the previous call stopped
+HttpParser::Status HttpParser::parse(string_view buffer) {
+    if (phase == DONE) {
+        return COMPLETE;
+    }
+    if (errorCode != 0) {
+        return ERROR;
+    }
+
+    //   request line and headers, one CRLF-terminated line at a time
+    while (phase == REQUEST_LINE || phase == HEADERS) {
+        size_t lineEnd = buffer.find("\r\n", searchOffset);
+        if (lineEnd == string_view::npos || lineEnd > MAX_HTTP_HEADER_BYTES) {
+            if (buffer.size() > MAX_HTTP_HEADER_BYTES) {
+                return fail(431, "Request Header Fields Too Large");
+            }
+            //   the next search only needs to revisit a possible trailing '\r'
+            searchOffset = buffer.empty() ? 0 : buffer.size() - 1;
+            if (searchOffset < lineStart) searchOffset = lineStart;
+            return NEED_MORE;
+        }
+
+        if (phase == REQUEST_LINE) {
+            //   stray CRLFs before the request line are ignored
+            if (lineEnd != lineStart) {
+                if (!parseRequestLine(buffer, lineEnd)) return ERROR;
+                phase = HEADERS;
+            }
+        } else if (lineEnd == lineStart) {
+            headerLength = lineEnd + 2;
+            phase = BODY;
+        } else if (!parseHeaderLine(buffer, lineEnd)) {
+            return ERROR;
+        }
+
+        lineStart = lineEnd + 2;
+        searchOffset = lineStart;
+    }
+
+    if (buffer.size() < headerLength + contentLength) {
+        return NEED_MORE;
+    }
+
+    //   views are only materialized once the whole request sits in the buffer
+    req.method = buffer.substr(method.offset, method.length);
+    req.path = buffer.substr(path.offset, path.length);
+    req.version = buffer.substr(version.offset, version.length);
+    req.headerCount = headerCount;
+    for (size_t i = 0; i < headerCount; i++) {
+        req.headers[i].name = buffer.substr(headerNames[i].offset, headerNames[i].length);
+        req.headers[i].value = buffer.substr(headerValues[i].offset, headerValues[i].length);
+    }
+    req.body = buffer.substr(headerLength, contentLength);
+    phase = DONE;
+    return COMPLETE;
+}
+
+//   checker whether the client allows the connection to stay open after this request
+bool wantsKeepAlive(const HttpRequest& req) {
+    string_view connection = req.header("Connection");
+    if (req.version == "HTTP/1.0") {
+        return equalsIgnoreCase(connection, "keep-alive");
+    }
+    return !equalsIgnoreCase(connection, "close");
+}
+
+//   pre-rendered header blocks shared by every response
+static const string_view CORS_HEADERS =
+    "Access-Control-Allow-Origin: *\r\n"
+    "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n"
+    "Access-Control-Allow-Headers: Content-Type, Authorization, X-Durability\r\n";
+static const string_view KEEP_ALIVE_HEADER = "Connection: keep-alive\r\n\r\n";
+static const string_view CLOSE_HEADER = "Connection: close\r\n\r\n";
+
+//   filler for the iovecs of this response, the CORS and Connection blocks are shared constants
+void HttpResponse::segments(struct iovec* iov, bool keepAlive) const {
+    string_view connection = keepAlive ? KEEP_ALIVE_HEADER : CLOSE_HEADER;
+    if (interim) {
+        iov[0] = {(void*)head.data(), head.size()};
+        iov[1] = iov[2] = {nullptr, 0};
+    } else if (headSent) {
+        iov[0] = iov[1] = iov[2] = {nullptr, 0};
+    } else {
+        iov[0] = {(void*)head.data(), head.size()};
+        iov[1] = {(void*)CORS_HEADERS.data(), CORS_HEADERS.size()};
+        iov[2] = {(void*)connection.data(), connection.size()};
+    }
+    iov[3] = {(void*)body.data(), body.size()};
+}
+
+//   bytes this response occupies on the wire (for a stream, up to the end of the current chunk)
+size_t HttpResponse::wireSize(bool keepAlive) const {
+    if (interim) {
+        return head.size();
+    }
+    size_t headSize = headSent ? 0 : head.size() + CORS_HEADERS.size() + (keepAlive ? KEEP_ALIVE_HEADER : CLOSE_HEADER).size();
+    return headSize + body.size();
+}
+
+//   refiller for body with the next chunk in chunked framing, false once the terminating chunk was queued
+bool HttpResponse::advanceStream() {
+    if (!stream || streamDone) {
+        return false;
+    }
+
+    if (!chunked) {
+        body.clear();
+        streamDone = !stream->next(body);
+        return true;
+    }
+
+    //   room is left in front of the data for the hex size line, so the chunk is framed in place
+    static const size_t SIZE_LINE_ROOM = 18;
+    body.assign(SIZE_LINE_ROOM, ' ');
+    bool more = stream->next(body);
+    size_t dataSize = body.size() - SIZE_LINE_ROOM;
+
+    if (dataSize == 0) {
+        body = "0\r\n\r\n";
+        streamDone = true;
+        return true;
+    }
+
+    char sizeLine[SIZE_LINE_ROOM + 1];
+    int lineLength = snprintf(sizeLine, sizeof(sizeLine), "%zx\r\n", dataSize);
+    body.replace(0, SIZE_LINE_ROOM, sizeLine, lineLength);
+    body += "\r\n";
+    if (!more) {
+        body += "0\r\n\r\n";
+        streamDone = true;
+    }
+    return true;
+}
+
+//   switcher for a stream to an unframed body delimited by closing the connection, for HTTP/1.0 clients
+void HttpResponse::sendUntilClose() {
+    static const string_view CHUNKED_HEADER = "Transfer-Encoding: chunked\r\n";
+    size_t at = head.find(CHUNKED_HEADER);
+    if (at != string::npos) {
+        head.erase(at, CHUNKED_HEADER.size());
+    }
+    chunked = false;
+}
+
+//   writer for the status line and Content-Type shared by both builders
+static string buildHead(int statusCode, const string& statusText, const string& contentType) {
+    string head;
+    head.reserve(96 + statusText.size() + contentType.size());
+    head += "HTTP/1.1 ";
+    head += to_string(statusCode);
+    head += ' ';
+    head += statusText;
+    head += "\r\nContent-Type: ";
+    head += contentType;
+    head += "\r\n";
+    return head;
+}
+
+//   builder for formatted HTTP response, the body is moved in rather than copied
+HttpResponse buildHttpResponse(int statusCode, string statusText, string body, string contentType) {
+    HttpResponse response;
+    response.head = buildHead(statusCode, statusText, contentType);
+    response.head += "Content-Length: ";
+    response.head += to_string(body.size());
+    response.head += "\r\n";
+    response.body = move(body);
+    return response;
+}
+
+//   builder for an interim 1xx response such as 100 Continue, sent ahead of the final one
+HttpResponse buildInterimResponse(int statusCode, string statusText) {
+    HttpResponse response;
+    response.head = "HTTP/1.1 " + to_string(statusCode) + " " + statusText + "\r\n\r\n";
+    response.interim = true;
+    return response;
+}
+
+//   builder for a Transfer-Encoding: chunked response whose body is pulled from stream as the socket drains
+HttpResponse buildStreamingResponse(int statusCode, string statusText, unique_ptr<ResponseStream> stream,
+                                    string contentType) {
+    HttpResponse response;
+    response.head = buildHead(statusCode, statusText, contentType);
+    response.head += "Transfer-Encoding: chunked\r\n";
+    response.stream = move(stream);
+    response.chunked = true;
+    return response;
 }
@@ -2,23 +2,166 @@
 #define HTTP_H
 
 #include <string>
-#include <map>
-#include <sstream>
+#include <string_view>
+#include <memory>
+#include <sys/uio.h>
 using namespace std;
 
 //   HTTP request parser section - parse incoming HTTP requests
 
+//   most headers a single request may carry before it is rejected with 431
+static const size_t MAX_HTTP_HEADERS = 32;
+
+//   largest request line plus header block accepted before it is rejected with 431
+static const size_t MAX_HTTP_HEADER_BYTES = 16384;
+
+//   default largest Content-Length accepted before the request is rejected with 413
+static const size_t DEFAULT_MAX_BODY_BYTES = 1 << 20;
+
+struct HttpHeader {
+    string_view name;
+    string_view value;
+};
+
+//   parsed request, every field is a view into the connection's receive buffer
+//   and stays valid only until that buffer is next modified
 struct HttpRequest {
-    string method;
-    string path;
-    map<string, string> headers;
-    string body;
+    string_view method;
+    string_view path;
+    string_view version;
+    HttpHeader headers[MAX_HTTP_HEADERS];
+    size_t headerCount = 0;
+    string_view body;
+
+    // finder for a header value by case-insensitive name, empty if absent
+    string_view header(string_view name) const;
 };
 
-//   parser for HTTP request string into structured data
-HttpRequest parseHttpRequest(string requestStr);
+//   incremental parser, fed the same growing buffer after every read until it reports COMPLETE or ERROR
+class HttpParser {
+public:
+    enum Status {
+        NEED_MORE,  // request not fully received yet
+        COMPLETE,   // request() and messageLength() are valid
+        ERROR       // errorStatus() / errorReason() describe the problem
+    };
+
+    // parser for the buffered bytes of the current request, resumes where the previous call stopped
+    Status parse(string_view buffer);
+
+    // parsed request, valid after COMPLETE for the buffer passed to parse()
+    const HttpRequest& request() const { return req; }
+
+    // checker whether the header block of the current request has been fully received
+    bool headersComplete() const { return phase == BODY || phase == DONE; }
+
+    // checker whether the client waits for "100 Continue" before sending the body (HTTP/1.1 only)
+    bool expectsContinue() const { return expectContinue; }
+
+    // setter for the largest Content-Length accepted, kept across reset()
+    void setMaxBodySize(size_t limit) { maxBodySize = limit; }
+
+    // bytes the complete request occupies at the front of the buffer
+    size_t messageLength() const { return headerLength + contentLength; }
+
+    // HTTP status and reason phrase to answer a malformed request with
+    int errorStatus() const { return errorCode; }
+    const char* errorReason() const { return errorText; }
+
+    // resetter for the next request on the same connection
+    void reset();
+
+private:
+    //   offsets are kept instead of views while parsing because the buffer may move between calls
+    struct Span {
+        size_t offset;
+        size_t length;
+    };
+
+    enum Phase { REQUEST_LINE, HEADERS, BODY, DONE };
+
+    // parser for the request line ending at lineEnd
+    bool parseRequestLine(string_view buffer, size_t lineEnd);
+
+    // parser for one header line ending at lineEnd
+    bool parseHeaderLine(string_view buffer, size_t lineEnd);
+
+    // setter for the error state
+    Status fail(int status, const char* reason);
+
+    Phase phase = REQUEST_LINE;
+    size_t lineStart = 0;
+    size_t searchOffset = 0;
+    size_t headerLength = 0;
+    size_t contentLength = 0;
+    bool sawContentLength = false;
+    bool expectContinue = false;
+    size_t maxBodySize = DEFAULT_MAX_BODY_BYTES;
+    Span method = {0, 0};
+    Span path = {0, 0};
+    Span version = {0, 0};
+    Span headerNames[MAX_HTTP_HEADERS];
+    Span headerValues[MAX_HTTP_HEADERS];
+    size_t headerCount = 0;
+    int errorCode = 0;
+    const char* errorText = "";
+    HttpRequest req;
+};
+
+//   checker whether the client allows the connection to stay open after this request
+bool wantsKeepAlive(const HttpRequest& req);
+
+//   HTTP response section - responses kept as separate buffers and written with writev
+
+//   iovecs one response occupies on the wire: head, CORS block, Connection block, body
+static const int HTTP_RESPONSE_SEGMENTS = 4;
+
+//   upper bound for one chunk of a streamed body, so a stream holds at most this much in memory
+static const size_t HTTP_STREAM_CHUNK_BYTES = 16384;
+
+//   producer for a body that is generated piece by piece while it is being sent
+class ResponseStream {
+public:
+    virtual ~ResponseStream() = default;
+
+    // appender for roughly HTTP_STREAM_CHUNK_BYTES of body to out, false once nothing is left
+    virtual bool next(string& out) = 0;
+};
+
+struct HttpResponse {
+    string head;    // status line, Content-Type and Content-Length (or Transfer-Encoding)
+    string body;    // whole body, or the current framed chunk of a streamed body
+
+    //   set for Transfer-Encoding: chunked responses, body is then refilled from it chunk by chunk
+    unique_ptr<ResponseStream> stream;
+    bool streamDone = false;
+    bool headSent = false;      // stream only: head is on the wire, only chunks remain
+    bool interim = false;       // 1xx: head only, without the CORS/Connection blocks or a body
+    bool chunked = false;       // stream only: body pieces carry chunked framing
+    uint64_t logSequence = 0;   // write-ahead log record that must be durable before this goes out, 0 = none
+    bool logSynced = true;      // logSequence must be fsynced, not only written
+
+    // filler for the iovecs of this response, the CORS and Connection blocks are shared constants
+    void segments(struct iovec* iov, bool keepAlive) const;
+
+    // bytes this response occupies on the wire (for a stream, up to the end of the current chunk)
+    size_t wireSize(bool keepAlive) const;
+
+    // refiller for body with the next chunk in chunked framing, false once the terminating chunk was queued
+    bool advanceStream();
+
+    // switcher for a stream to an unframed body delimited by closing the connection, for HTTP/1.0 clients
+    void sendUntilClose();
+};
+
+//   builder for formatted HTTP response, the body is moved in rather than copied
+HttpResponse buildHttpResponse(int statusCode, string statusText, string body, string contentType = "application/json");
+
+//   builder for an interim 1xx response such as 100 Continue, sent ahead of the final one
+HttpResponse buildInterimResponse(int statusCode, string statusText);
 
-//   builder for formatted HTTP response
-string buildHttpResponse(int statusCode, string statusText, string body, string contentType = "application/json");
+//   builder for a Transfer-Encoding: chunked response whose body is pulled from stream as the socket drains
+HttpResponse buildStreamingResponse(int statusCode, string statusText, unique_ptr<ResponseStream> stream,
+                                    string contentType = "application/json");
 
 #endif // HTTP_H
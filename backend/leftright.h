@@ -0,0 +1,95 @@
+#ifndef LEFTRIGHT_H
+#define LEFTRIGHT_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+using namespace std;
+
+//   left-right section - two copies of a structure, so its readers never wait for its writer
+
+//   readers pin the published copy by bumping a reader counter and read it without any lock; the writer (one at
+//   a time, holding writerLock()) applies a change to the standby copy, publishes it, waits for the readers still
+//   on the old copy to leave and applies the same change there. Changes must be deterministic, so both copies
+//   stay identical; the cost is holding the structure twice
+
+//   reader counters per copy, spread over cache lines so threads pinning at once do not share one
+static const int LEFT_RIGHT_SLOTS = 16;
+
+//   reader counter slot of the calling thread, handed out round-robin on first use
+inline int leftRightSlot() {
+    static atomic<int> nextSlot{0};
+    thread_local int slot = nextSlot.fetch_add(1, memory_order_relaxed) % LEFT_RIGHT_SLOTS;
+    return slot;
+}
+
+template <typename T>
+class LeftRight {
+public:
+    // pinner for a reader to the published copy, returns the side to read and later unpin; never waits
+    int pin(int slot) {
+        //   announce on the side that looks published, then check it still is: a writer that flipped in between
+        //   may already have seen this counter at zero, so back off and retry on the new side
+        while (true) {
+            int side = published.load(memory_order_seq_cst);
+            readers[side][slot].count.fetch_add(1, memory_order_seq_cst);
+            if (published.load(memory_order_seq_cst) == side) return side;
+            readers[side][slot].count.fetch_sub(1, memory_order_release);
+        }
+    }
+
+    // unpinner for a reader pinned with pin()
+    void unpin(int side, int slot) { readers[side][slot].count.fetch_sub(1, memory_order_release); }
+
+    // copy a pinned reader reads
+    const T& side(int which) const { return sides[which]; }
+
+    // published copy, for the thread holding writerLock()
+    const T& current() const { return sides[published.load(memory_order_relaxed)]; }
+
+    // mutex every writer holds around modify(); a thread holding a pin must not wait for it
+    mutex& writerLock() { return writer; }
+
+    // applier for one change to both copies, returning what the first application returned; caller holds
+    // writerLock() and no pin
+    template <typename Change>
+    auto modify(Change change) -> decltype(change(declval<T&>())) {
+        int old = published.load(memory_order_relaxed);
+        auto result = change(sides[1 - old]);
+        published.store(1 - old, memory_order_seq_cst);
+        waitForReaders(old);
+        change(sides[old]);
+        return result;
+    }
+
+    // filler for both copies at once, while no reader or writer exists yet: fill builds one and the other is
+    // copy-assigned from it, which is cheaper than building it again
+    template <typename Fill>
+    void reset(Fill fill) {
+        fill(sides[0]);
+        sides[1] = sides[0];
+    }
+
+private:
+    // waiter until no reader is left on side; readers only stay pinned while one response is built
+    void waitForReaders(int side) {
+        for (ReaderCount& reader : readers[side]) {
+            while (reader.count.load(memory_order_seq_cst) != 0) {
+                this_thread::yield();
+            }
+        }
+    }
+
+    struct alignas(64) ReaderCount {
+        atomic<uint64_t> count{0};
+    };
+
+    T sides[2];
+    atomic<int> published{0};
+    mutex writer;
+    ReaderCount readers[2][LEFT_RIGHT_SLOTS];
+};
+
+#endif // LEFTRIGHT_H
@@ -8,32 +8,39 @@
 #include <unistd.h>
 #include <string>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <vector>
 #include "models.h"
 #include "datastore.h"
 #include "http.h"
 #include "router.h"
+#include "eventloop.h"
+#include "uringloop.h"
+#include "config.h"
+#include "admission.h"
+#include "compactor.h"
+#include "snapshot.h"
 
 using namespace std;
 
-//   main server loop
-int main() {
-    DataStore store;
-    
-    //    get port from environment or default to 8080
-    const char* portEnv = getenv("PORT");
-    int port = portEnv ? atoi(portEnv) : 8080;
-    
+//   creator for a listening socket on the given port, one per worker via SO_REUSEPORT
+static int createListenSocket(int port, int backlog) {
     //   creator for TCP socket
     int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
     if (serverSocket < 0) {
         cerr << "Error creating socket" << endl;
-        return 1;
+        return -1;
     }
     
     //   socket reuse enabler to avoid "address already in use" errors
     int opt = 1;
     setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
     
+    //   port sharing so every worker gets its own accept queue balanced by the kernel
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    
     //   configurator for server address and port
     struct sockaddr_in serverAddr;
     serverAddr.sin_family = AF_INET;
@@ -43,18 +50,109 @@ int main() {
     //   binder for socket to port 8080
     if (::bind(serverSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
         cerr << "Error binding socket" << endl;
-        return 1;
+        close(serverSocket);
+        return -1;
     }
     
-    //   listener for incoming connections
-    if (listen(serverSocket, 10) < 0) {
+    //   listener for incoming connections, the backlog bounds connections waiting to be accepted
+    if (listen(serverSocket, backlog) < 0) {
         cerr << "Error listening on socket" << endl;
-        return 1;
+        close(serverSocket);
+        return -1;
+    }
+    return serverSocket;
+}
+
+//   runner for one worker's event loop on the selected I/O backend
+static void runWorker(DataStore& store, int listenFd, const ServerConfig& config, AdmissionControl& admission,
+                      bool useUring) {
+    if (useUring) {
+        UringLoop loop(store, listenFd, config, admission);
+        if (loop.ready()) {
+            loop.run();
+            return;
+        }
+        cerr << "io_uring setup failed, worker falling back to epoll" << endl;
+    }
+    EventLoop loop(store, listenFd, config, admission);
+    loop.run();
+}
+
+//   converter between the binary snapshot and its JSON form, for "--to-json data.snap data.json" and
+//   "--from-json data.json data.snap"; the write-ahead log is left alone, the walSegment field carries over
+static int convertSnapshot(const string& mode, const string& from, const string& to) {
+    SnapshotTables tables;
+    if (mode == "--to-json") {
+        string error;
+        if (!readBinarySnapshot(from, tables, error)) {
+            cerr << "Error reading snapshot " << from << ": " << (error.empty() ? "no such file" : error) << endl;
+            return 1;
+        }
+        string contents = snapshotToJson(tables).dump(4);
+        if (!writeFileAtomically(to, {contents})) {
+            cerr << "Error writing " << to << ": " << strerror(errno) << endl;
+            return 1;
+        }
+    } else {
+        string error;
+        if (!readJsonSnapshot(from, tables, error)) {
+            cerr << "Error reading " << from << ": " << (error.empty() ? "no such file" : error) << endl;
+            return 1;
+        }
+        if (!writeBinarySnapshot(to, tables)) {
+            cerr << "Error writing snapshot " << to << ": " << strerror(errno) << endl;
+            return 1;
+        }
+    }
+    cout << "Converted " << from << " to " << to << ": " << tables.users.size() << " users, "
+         << tables.courses.size() << " courses, " << tables.enrollments.size() << " enrollments, "
+         << tables.grades.size() << " grades" << endl;
+    return 0;
+}
+
+//   main server loop
+int main(int argc, char* argv[]) {
+    if (argc == 4 && (string(argv[1]) == "--to-json" || string(argv[1]) == "--from-json")) {
+        return convertSnapshot(argv[1], argv[2], argv[3]);
+    }
+    if (argc > 1) {
+        cerr << "Usage: " << argv[0] << " [--to-json SNAPSHOT JSON | --from-json JSON SNAPSHOT]" << endl;
+        return 2;
+    }
+
+    ServerConfig config = loadServerConfig();
+    DataStore store(config);
+    Compactor compactor(store, config);
+    int port = config.port;
+    AdmissionControl admission(config);
+    
+    //   one listening socket per worker, all bound to the same port
+    vector<int> listenSockets;
+    for (int i = 0; i < config.workers; i++) {
+        int serverSocket = createListenSocket(port, config.listenBacklog);
+        if (serverSocket < 0) {
+            return 1;
+        }
+        listenSockets.push_back(serverSocket);
+    }
+    
+    //   io_uring is opt-in and only used when the kernel supports everything it needs
+    bool useUring = false;
+    if (config.ioBackend == "uring") {
+        useUring = UringLoop::supported();
+        if (!useUring) {
+            cerr << "io_uring not supported by this kernel, using epoll" << endl;
+        }
     }
     
     cout << "========================================" << endl;
     cout << "School Management System Backend" << endl;
     cout << "Server running on http://0.0.0.0:" << port << endl;
+    cout << "Worker threads: " << config.workers << endl;
+    cout << "I/O backend: " << (useUring ? "io_uring" : "epoll") << endl;
+    if (config.connectionsHighWatermark > 0) {
+        cout << "Connection limit: " << config.connectionsHighWatermark << " (503 beyond)" << endl;
+    }
     cout << "========================================" << endl;
     cout << "\nDefault Credentials:" << endl;
     cout << "Teachers:" << endl;
@@ -66,68 +164,20 @@ int main() {
     cout << "  - Password: john123, jane123, bob123" << endl;
     cout << "========================================\n" << endl;
     
-    //   main server loop - accept and handle connections
-    while (true) {
-        struct sockaddr_in clientAddr;
-        socklen_t clientLen = sizeof(clientAddr);
-        
-        //   acceptor for incoming connection
-        int clientSocket = accept(serverSocket, (struct sockaddr*)&clientAddr, &clientLen);
-        
-        if (clientSocket < 0) {
-            cerr << "Error accepting connection" << endl;
-            continue;
-        }
-        
-        //   reader for incoming request data (read all available data)
-        string requestStr;
-        char buffer[4096] = {0};
-        ssize_t bytesRead;
-        
-        // Read first chunk
-        bytesRead = read(clientSocket, buffer, sizeof(buffer) - 1);
-        if (bytesRead > 0) {
-            buffer[bytesRead] = '\0';
-            requestStr = string(buffer);
-            
-            // Parse headers to check for Content-Length
-            size_t headerEnd = requestStr.find("\r\n\r\n");
-            if (headerEnd != string::npos) {
-                size_t clPos = requestStr.find("Content-Length:");
-                if (clPos != string::npos && clPos < headerEnd) {
-                    // Extract Content-Length value
-                    size_t clStart = clPos + 15; // Length of "Content-Length:"
-                    size_t clEnd = requestStr.find("\r\n", clStart);
-                    int contentLength = stoi(requestStr.substr(clStart, clEnd - clStart));
-                    
-                    // Calculate how much body we've already read
-                    int bodyStart = headerEnd + 4;
-                    int bodyReceived = bytesRead - bodyStart;
-                    
-                    // Read remaining body if needed
-                    while (bodyReceived < contentLength) {
-                        bytesRead = read(clientSocket, buffer, sizeof(buffer) - 1);
-                        if (bytesRead <= 0) break;
-                        buffer[bytesRead] = '\0';
-                        requestStr += string(buffer);
-                        bodyReceived += bytesRead;
-                    }
-                }
-            }
-        }
-        
-        //   parser for HTTP request and route to handler
-        HttpRequest req = parseHttpRequest(requestStr);
-        cout << "Request: " << req.method << " " << req.path << endl;
-        
-        //    get response from appropriate handler
-        string response = routeRequest(store, req);
-        
-        //   sender for response and close connection
-        write(clientSocket, response.c_str(), response.length());
-        close(clientSocket);
+    //   worker pool - each thread runs its own epoll reactor on its own listener
+    vector<thread> workers;
+    for (size_t i = 1; i < listenSockets.size(); i++) {
+        workers.emplace_back(runWorker, ref(store), listenSockets[i], cref(config), ref(admission), useUring);
     }
     
-    close(serverSocket);
+    //   main thread serves as worker 0
+    runWorker(store, listenSockets[0], config, admission, useUring);
+    
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (int fd : listenSockets) {
+        close(fd);
+    }
     return 0;
 }
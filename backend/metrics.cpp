@@ -0,0 +1,18 @@
+#include "metrics.h"
+
+//   accessor for the process-wide metrics
+ServerMetrics& serverMetrics() {
+    static ServerMetrics metrics;
+    return metrics;
+}
+
+//   name of a reap reason as reported by the metrics endpoint
+const char* reapReasonName(ReapReason reason) {
+    switch (reason) {
+        case REAP_HEADER_TIMEOUT: return "headerTimeout";
+        case REAP_BODY_TIMEOUT: return "bodyTimeout";
+        case REAP_IDLE_TIMEOUT: return "idleTimeout";
+        case REAP_WRITE_TIMEOUT: return "writeTimeout";
+        default: return "unknown";
+    }
+}
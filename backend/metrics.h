@@ -0,0 +1,44 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+//   server metrics section - process-wide counters shared by every worker and the compactor, served by GET /api/metrics
+
+//   deadlines a connection can miss, each closes it and counts as a reap for that reason
+enum ReapReason {
+    REAP_HEADER_TIMEOUT,    // request line and headers not received in time (slowloris, silent clients)
+    REAP_BODY_TIMEOUT,      // declared body not received in time
+    REAP_IDLE_TIMEOUT,      // kept-alive connection with no new request
+    REAP_WRITE_TIMEOUT,     // client stopped reading its responses
+    REAP_REASONS
+};
+
+struct ServerMetrics {
+    atomic<uint64_t> connectionsAccepted{0};    // admitted by admission control
+    atomic<int64_t> connectionsOpen{0};         // admitted and not yet closed, across all workers
+    atomic<uint64_t> connectionsShed{0};        // answered with 503 and closed on accept
+    atomic<uint64_t> connectionsReaped[REAP_REASONS] = {};
+    atomic<uint64_t> snapshotsWritten{0};       // data.json snapshots that replaced the previous one
+    atomic<uint64_t> snapshotFailures{0};       // snapshots abandoned, the log segments they would cover are kept
+    atomic<uint64_t> walBatches{0};             // group commits, each one write and one fdatasync
+    atomic<uint64_t> walRecords{0};             // records those batches carried
+    atomic<uint64_t> textBytes{0};              // held by string pools, values no record refers to any more included
+    atomic<uint64_t> snapshotTextBytes{0};      // text of the snapshot last written or read, what a restart's pool holds
+};
+
+//   accessor for the process-wide metrics
+ServerMetrics& serverMetrics();
+
+//   name of a reap reason as reported by the metrics endpoint
+const char* reapReasonName(ReapReason reason);
+
+//   counter bump for one more event, relaxed because the counters are only ever read as a snapshot
+inline void countMetric(atomic<uint64_t>& counter) {
+    counter.fetch_add(1, memory_order_relaxed);
+}
+
+#endif // METRICS_H
@@ -1,41 +1,70 @@
 #ifndef MODELS_H
 #define MODELS_H
 
-#include <string>
+#include <cstdint>
+#include <string_view>
 using namespace std;
 
 //   data models section - define user, course, enrollment, and grade structures
 
+//   dense handle for an interned external id ("JD001", "C001"); the string form lives once in the
+//   DataStore (DataStore::idString) and is only used at the JSON boundary
+using IdHandle = uint32_t;
+
+//   handle of an id that was never interned
+static const IdHandle NO_ID = UINT32_MAX;
+
+//   handle for a text field's value in the DataStore's StringPool (DataStore::text); records hold handles
+//   instead of strings so a table is one flat array, and a value repeated across rows is stored once
+using TextHandle = uint32_t;
+
+//   handle of "", interned by every pool up front so a zeroed field reads as empty
+static const TextHandle EMPTY_TEXT = 0;
+
+//   role of a user, one byte; any role name other than the two the API knows is OTHER
+enum class Role : uint8_t { OTHER, STUDENT, TEACHER };
+
+inline Role roleFromName(string_view name) {
+    return name == "student" ? Role::STUDENT : name == "teacher" ? Role::TEACHER : Role::OTHER;
+}
+
+//   users are split by how often a field is read: User is the hot part (16 bytes, four to a cache line) read by
+//   id lookups, role checks and roster scans; UserDetails is the cold part only login, signup and snapshots
+//   read. The DataStore keeps them in two tables indexed by the same slot
 struct User {
-    string id;
-    string username;
-    string password;
-    string role;
-    string name;
-    string firstName;
-    string lastName;
-    string dateOfBirth;
-    string email;
+    IdHandle id;
+    Role role;
+    TextHandle username;
+    TextHandle name;
+};
+
+struct UserDetails {
+    TextHandle password;
+    TextHandle roleName;    // role as it was given, so one that is OTHER survives a snapshot unchanged
+    TextHandle firstName;
+    TextHandle lastName;
+    TextHandle dateOfBirth;
+    TextHandle email;
 };
 
 struct Course {
-    string id;
-    string name;
-    string teacherId;
-    string description;
+    IdHandle id;
+    TextHandle name;
+    IdHandle teacherId;
+    TextHandle description;
 };
 
 struct Enrollment {
-    string studentId;
-    string courseId;
+    IdHandle studentId;
+    IdHandle courseId;
 };
 
 struct Grade {
-    string studentId;
-    string courseId;
+    IdHandle studentId;
+    IdHandle courseId;
     int score;
-    string note;
-    string teacherId;
+    TextHandle note;
+    IdHandle teacherId;
 };
 
 #endif // MODELS_H
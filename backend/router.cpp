@@ -1,8 +1,9 @@
 #include "router.h"
 #include <iostream>
+#include <stdexcept>
 
-//   router for HTTP requests to appropriate handlers
-string routeRequest(DataStore& store, HttpRequest req) {
+//   dispatcher for a request to its handler, caller holds the lock or pin its route needs
+static HttpResponse dispatchRequest(DataStore& store, const HttpRequest& req) {
     //   Debug logging for POST requests
     if (req.method == "POST") {
         std::cout << "POST " << req.path << " - Body length: " << req.body.length() << std::endl;
@@ -37,32 +38,32 @@ string routeRequest(DataStore& store, HttpRequest req) {
     }
     
     //    get student's enrolled courses endpoint
-    if (req.method == "GET" && req.path.find("/api/students/") == 0 && req.path.find("/courses") != string::npos) {
+    if (req.method == "GET" && req.path.find("/api/students/") == 0 && req.path.find("/courses") != string_view::npos) {
         size_t start = 14; // length of "/api/students/"
         size_t end = req.path.find("/courses");
-        string studentId = req.path.substr(start, end - start);
+        string studentId(req.path.substr(start, end - start));
         return handleGetStudentCourses(store, studentId);
     }
     
     //    get enrolled students for a course endpoint
-    if (req.method == "GET" && req.path.find("/api/courses/") == 0 && req.path.find("/students") != string::npos) {
+    if (req.method == "GET" && req.path.find("/api/courses/") == 0 && req.path.find("/students") != string_view::npos) {
         size_t start = 13; // length of "/api/courses/"
         size_t end = req.path.find("/students");
-        string courseId = req.path.substr(start, end - start);
+        string courseId(req.path.substr(start, end - start));
         return handleGetCourseStudents(store, courseId);
     }
     
     //    get student grades endpoint
     if (req.method == "GET" && req.path.find("/api/grades/") == 0) {
-        string studentId = req.path.substr(12); // Extract student ID
+        string studentId(req.path.substr(12)); // Extract student ID
         return handleGetStudentGrades(store, studentId);
     }
     
     //    get teacher's grades endpoint
-    if (req.method == "GET" && req.path.find("/api/teacher/") == 0 && req.path.find("/grades") != string::npos) {
+    if (req.method == "GET" && req.path.find("/api/teacher/") == 0 && req.path.find("/grades") != string_view::npos) {
         size_t start = 13; // length of "/api/teacher/"
         size_t end = req.path.find("/grades");
-        string teacherId = req.path.substr(start, end - start);
+        string teacherId(req.path.substr(start, end - start));
         return handleGetTeacherGrades(store, teacherId);
     }
     
@@ -91,3 +92,64 @@ string routeRequest(DataStore& store, HttpRequest req) {
     response["error"] = "Endpoint not found";
     return buildHttpResponse(404, "Not Found", response.dump());
 }
+
+//   level a mutation is acknowledged at: the X-Durability header if it names one, else the route's default
+static WriteAheadLog::Durability requestDurability(const DataStore& store, const HttpRequest& req) {
+    WriteAheadLog::Durability level;
+    if (WriteAheadLog::parseDurability(req.header("X-Durability"), level)) {
+        return level;
+    }
+    return store.defaultDurability(req.path == "/api/enroll" || req.path == "/api/unenroll");
+}
+
+//   router for HTTP requests to appropriate handlers
+HttpResponse routeRequest(DataStore& store, const HttpRequest& req) {
+    //   server metrics never touch the store, so they are answered without its lock
+    if (req.method == "GET" && req.path == "/api/metrics") {
+        return handleGetMetrics();
+    }
+
+    //   GETs (and login, which only reads) pin the published tables without ever waiting; enroll and grade writes
+    //   lock only their student's shard inside the store, everything else runs one request at a time
+    //   a body that is not the JSON a handler expects is answered with 400 instead of escaping the event loop
+    try {
+        if (req.method == "GET" || req.method == "OPTIONS" || req.path == "/api/login") {
+            auto guard = store.readLock();
+            return dispatchRequest(store, req);
+        }
+        //   a change the log cannot record would be lost on restart, so none is made once the log broke
+        if (store.logBroken()) {
+            json response;
+            response["success"] = false;
+            response["message"] = "Changes cannot be saved right now";
+            return buildHttpResponse(503, "Service Unavailable", response.dump());
+        }
+
+        //   a response to a mutation carries its log record, the event loop sends it only once that reached the
+        //   requested durability; fire-and-forget responses go out at once, readers see the change either way
+        WriteAheadLog::Durability level = requestDurability(store, req);
+        unique_lock<mutex> guard;
+        if (req.path != "/api/enroll" && req.path != "/api/unenroll" && req.path != "/api/grades") {
+            guard = store.writeLock();
+        }
+        uint64_t before = store.logSequence();
+        HttpResponse response = dispatchRequest(store, req);
+        uint64_t after = store.logSequence();
+        if (after != before && level != WriteAheadLog::QUEUED) {
+            response.logSequence = after;
+            response.logSynced = level == WriteAheadLog::SYNCED;
+        }
+        return response;
+    } catch (const json::exception&) {
+        json response;
+        response["success"] = false;
+        response["message"] = "Invalid request body";
+        return buildHttpResponse(400, "Bad Request", response.dump());
+    } catch (const length_error&) {
+        //   the string pool is full; text is interned before any table changes, so nothing was half applied
+        json response;
+        response["success"] = false;
+        response["message"] = "Text storage is full, a restart reclaims unused text";
+        return buildHttpResponse(507, "Insufficient Storage", response.dump());
+    }
+}
@@ -9,6 +9,6 @@
 using namespace std;
 
 //   router for HTTP requests to appropriate handlers
-string routeRequest(DataStore& store, HttpRequest req);
+HttpResponse routeRequest(DataStore& store, const HttpRequest& req);
 
 #endif
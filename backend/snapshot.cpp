@@ -0,0 +1,708 @@
+#include "snapshot.h"
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstddef>
+#include "wal.h"
+#include "metrics.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the binary snapshot format is little-endian and read in place"
+#endif
+
+//   binary format section - the structs below are the file layout, read straight out of the mapping
+
+static const char SNAPSHOT_MAGIC[8] = {'S', 'M', 'S', 'S', 'N', 'A', 'P', '\0'};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+enum SnapshotSection { STRINGS, TEXT, USERS, COURSES, ENROLLMENTS, GRADES, SECTION_COUNT };
+
+struct SectionEntry {
+    uint64_t offset;    // from the start of the file, a multiple of 8
+    uint64_t bytes;
+    uint64_t count;     // strings, text bytes or records
+    uint32_t crc;
+    uint32_t reserved;
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t idCount;   // strings 0..idCount-1 are the interned ids, by IdHandle
+    uint64_t walSegment;
+    SectionEntry sections[SECTION_COUNT];
+    uint32_t headerCrc; // of every byte before this field
+    uint32_t reserved;
+};
+
+struct UserRecord {
+    uint32_t id, username, password, role, name, firstName, lastName, dateOfBirth, email;
+};
+
+struct CourseRecord {
+    uint32_t id, name, teacherId, description;
+};
+
+struct EnrollmentRecord {
+    uint32_t studentId, courseId;
+};
+
+struct GradeRecord {
+    uint32_t studentId, courseId;
+    int32_t score;
+    uint32_t note, teacherId;
+};
+
+static_assert(sizeof(SnapshotHeader) == 224, "snapshot header layout changed");
+static_assert(sizeof(UserRecord) == 36 && sizeof(CourseRecord) == 16 && sizeof(EnrollmentRecord) == 8 &&
+              sizeof(GradeRecord) == 20, "snapshot record layout changed");
+
+//   builder for the string table, each distinct value stored once; the views it is keyed by point into the
+//   tables being written, which outlive it
+class StringTableBuilder {
+public:
+    // adder for a string at the next index even if it is already present, used for the ids
+    uint32_t append(string_view value) {
+        uint32_t index = offsets.size() - 1;
+        indexByValue.emplace(value, index);
+        text.append(value);
+        offsets.push_back(text.size());
+        return index;
+    }
+
+    // index of a string, added on first use
+    uint32_t intern(string_view value) {
+        auto it = indexByValue.find(value);
+        return it != indexByValue.end() ? it->second : append(value);
+    }
+
+    vector<uint64_t> offsets = {0};
+    string text;
+
+private:
+    unordered_map<string_view, uint32_t> indexByValue;
+};
+
+//   byte view of a record array
+template <typename T>
+static string_view bytesOf(const vector<T>& records) {
+    return string_view((const char*)records.data(), records.size() * sizeof(T));
+}
+
+//   writer for a binary snapshot, replacing path atomically
+bool writeBinarySnapshot(const string& path, const SnapshotTables& tables) {
+    StringTableBuilder strings;
+    for (const string& id : tables.idNames) {
+        strings.append(id);
+    }
+
+    //   only the values a record still refers to are written, so text left behind in the pool is dropped here
+    auto text = [&](TextHandle handle) { return strings.intern(tables.text->view(handle)); };
+
+    vector<UserRecord> users;
+    users.reserve(tables.users.size());
+    for (size_t i = 0; i < tables.users.size(); i++) {
+        const User& u = tables.users[i];
+        const UserDetails& d = tables.userDetails[i];
+        users.push_back({u.id, text(u.username), text(d.password), text(d.roleName), text(u.name),
+                         text(d.firstName), text(d.lastName), text(d.dateOfBirth), text(d.email)});
+    }
+    vector<CourseRecord> courses;
+    courses.reserve(tables.courses.size());
+    for (const Course& c : tables.courses) {
+        courses.push_back({c.id, text(c.name), c.teacherId, text(c.description)});
+    }
+    vector<EnrollmentRecord> enrollments;
+    enrollments.reserve(tables.enrollments.size());
+    for (const Enrollment& e : tables.enrollments) {
+        enrollments.push_back({e.studentId, e.courseId});
+    }
+    vector<GradeRecord> grades;
+    grades.reserve(tables.grades.size());
+    for (const Grade& g : tables.grades) {
+        grades.push_back({g.studentId, g.courseId, g.score, text(g.note), g.teacherId});
+    }
+
+    //   sections in file order, each padded to the next multiple of 8
+    string_view bodies[SECTION_COUNT] = {bytesOf(strings.offsets), strings.text, bytesOf(users), bytesOf(courses),
+                                         bytesOf(enrollments), bytesOf(grades)};
+    uint64_t counts[SECTION_COUNT] = {strings.offsets.size() - 1, strings.text.size(), users.size(),
+                                      courses.size(), enrollments.size(), grades.size()};
+    static const char padding[8] = {};
+
+    SnapshotHeader header = {};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.idCount = tables.idNames.size();
+    header.walSegment = tables.walSegment;
+
+    vector<string_view> pieces = {string_view((const char*)&header, sizeof(header))};
+    uint64_t offset = sizeof(header);
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        header.sections[s] = {offset, bodies[s].size(), counts[s], crc32(bodies[s]), 0};
+        pieces.push_back(bodies[s]);
+        offset += bodies[s].size();
+        if (offset % 8 != 0) {
+            pieces.push_back(string_view(padding, 8 - offset % 8));
+            offset += 8 - offset % 8;
+        }
+    }
+    header.headerCrc = crc32(string_view((const char*)&header, offsetof(SnapshotHeader, headerCrc)));
+    if (!writeFileAtomically(path, pieces)) {
+        return false;
+    }
+    serverMetrics().snapshotTextBytes.store(strings.text.size(), memory_order_relaxed);
+    return true;
+}
+
+//   read-only mapping of a whole file, unmapped when it goes out of scope
+class FileMapping {
+public:
+    ~FileMapping() {
+        if (base != MAP_FAILED) {
+            munmap(base, size);
+        }
+    }
+
+    // mapper for path, false with errno set if it cannot be opened or mapped
+    bool map(const string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) < 0) {
+            close(fd);
+            return false;
+        }
+        size = info.st_size;
+        if (size > 0) {
+            base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        }
+        close(fd);
+        if (size > 0 && base == MAP_FAILED) {
+            return false;
+        }
+        if (size > 0) {
+            madvise(base, size, MADV_SEQUENTIAL);
+        }
+        return true;
+    }
+
+    const char* data() const { return (const char*)base; }
+
+    void* base = MAP_FAILED;
+    size_t size = 0;
+};
+
+//   checker for one section: inside the file, aligned, the expected size, intact
+static bool checkSection(const FileMapping& file, const SectionEntry& section, uint64_t elementSize,
+                         uint64_t extraElements) {
+    if (section.offset % 8 != 0 || section.offset > file.size || section.bytes > file.size - section.offset) {
+        return false;
+    }
+    if (section.bytes != (section.count + extraElements) * elementSize) {
+        return false;
+    }
+    return crc32(string_view(file.data() + section.offset, section.bytes)) == section.crc;
+}
+
+//   reader for a binary snapshot; records are validated against the string table before any is used, so a
+//   snapshot that passes its checksums but was written by a broken encoder cannot index out of the mapping
+bool readBinarySnapshot(const string& path, SnapshotTables& tables, string& error) {
+    FileMapping file;
+    if (!file.map(path)) {
+        error = errno == ENOENT ? "" : strerror(errno);
+        return false;
+    }
+    if (file.size < sizeof(SnapshotHeader)) {
+        error = "file is shorter than its header";
+        return false;
+    }
+
+    const SnapshotHeader& header = *(const SnapshotHeader*)file.data();
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        error = "not a snapshot file";
+        return false;
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        error = "unsupported snapshot version " + to_string(header.version);
+        return false;
+    }
+    if (crc32(string_view(file.data(), offsetof(SnapshotHeader, headerCrc))) != header.headerCrc) {
+        error = "header checksum mismatch";
+        return false;
+    }
+
+    static const uint64_t elementSizes[SECTION_COUNT] = {sizeof(uint64_t), 1, sizeof(UserRecord),
+                                                         sizeof(CourseRecord), sizeof(EnrollmentRecord),
+                                                         sizeof(GradeRecord)};
+    for (int s = 0; s < SECTION_COUNT; s++) {
+        if (!checkSection(file, header.sections[s], elementSizes[s], s == STRINGS ? 1 : 0)) {
+            error = "section " + to_string(s) + " is damaged";
+            return false;
+        }
+    }
+
+    //   string table: offsets ascending and inside the text
+    const SectionEntry& textSection = header.sections[TEXT];
+    const uint64_t* offsets = (const uint64_t*)(file.data() + header.sections[STRINGS].offset);
+    uint64_t stringCount = header.sections[STRINGS].count;
+    const char* text = file.data() + textSection.offset;
+    if (offsets[0] != 0 || offsets[stringCount] != textSection.bytes || header.idCount > stringCount) {
+        error = "string table is inconsistent";
+        return false;
+    }
+    for (uint64_t i = 0; i < stringCount; i++) {
+        if (offsets[i] > offsets[i + 1]) {
+            error = "string table is inconsistent";
+            return false;
+        }
+    }
+    auto stringAt = [&](uint32_t index) {
+        return string_view(text + offsets[index], offsets[index + 1] - offsets[index]);
+    };
+    auto isString = [&](uint32_t index) { return index < stringCount; };
+    auto isId = [&](uint32_t index) { return index < header.idCount; };
+
+    const UserRecord* users = (const UserRecord*)(file.data() + header.sections[USERS].offset);
+    const CourseRecord* courses = (const CourseRecord*)(file.data() + header.sections[COURSES].offset);
+    const EnrollmentRecord* enrollments =
+        (const EnrollmentRecord*)(file.data() + header.sections[ENROLLMENTS].offset);
+    const GradeRecord* grades = (const GradeRecord*)(file.data() + header.sections[GRADES].offset);
+
+    bool valid = true;
+    for (uint64_t i = 0; i < header.sections[USERS].count; i++) {
+        const UserRecord& u = users[i];
+        valid = valid && isId(u.id) && isString(u.username) && isString(u.password) && isString(u.role) &&
+                isString(u.name) && isString(u.firstName) && isString(u.lastName) && isString(u.dateOfBirth) &&
+                isString(u.email);
+    }
+    for (uint64_t i = 0; i < header.sections[COURSES].count; i++) {
+        const CourseRecord& c = courses[i];
+        valid = valid && isId(c.id) && isString(c.name) && isId(c.teacherId) && isString(c.description);
+    }
+    for (uint64_t i = 0; i < header.sections[ENROLLMENTS].count; i++) {
+        valid = valid && isId(enrollments[i].studentId) && isId(enrollments[i].courseId);
+    }
+    for (uint64_t i = 0; i < header.sections[GRADES].count; i++) {
+        const GradeRecord& g = grades[i];
+        valid = valid && isId(g.studentId) && isId(g.courseId) && isString(g.note) && isId(g.teacherId);
+    }
+    if (!valid) {
+        error = "a record refers past the string table";
+        return false;
+    }
+
+    //   ids keep their handles, so the handle-typed fields are copied as they are; the other strings go into the
+    //   pool in file order without dedup lookups, the string table being deduplicated already
+    tables = SnapshotTables();
+    tables.walSegment = header.walSegment;
+    tables.text = make_shared<StringPool>();
+    for (uint32_t i = 0; i < header.idCount; i++) {
+        tables.idNames.emplace_back(stringAt(i));
+    }
+    vector<TextHandle> textHandles(stringCount);
+    for (uint64_t i = header.idCount; i < stringCount; i++) {
+        textHandles[i] = tables.text->add(stringAt(i));
+    }
+    auto textAt = [&](uint32_t index) {
+        //   a text value equal to an id shares the id's string
+        return index >= header.idCount ? textHandles[index] : tables.text->intern(stringAt(index));
+    };
+    tables.users.reserve(header.sections[USERS].count);
+    tables.userDetails.reserve(header.sections[USERS].count);
+    for (uint64_t i = 0; i < header.sections[USERS].count; i++) {
+        const UserRecord& u = users[i];
+        tables.users.push_back({u.id, roleFromName(stringAt(u.role)), textAt(u.username), textAt(u.name)});
+        tables.userDetails.push_back({textAt(u.password), textAt(u.role), textAt(u.firstName), textAt(u.lastName),
+                                      textAt(u.dateOfBirth), textAt(u.email)});
+    }
+    tables.courses.reserve(header.sections[COURSES].count);
+    for (uint64_t i = 0; i < header.sections[COURSES].count; i++) {
+        const CourseRecord& c = courses[i];
+        tables.courses.push_back({c.id, textAt(c.name), c.teacherId, textAt(c.description)});
+    }
+    tables.enrollments.reserve(header.sections[ENROLLMENTS].count);
+    for (uint64_t i = 0; i < header.sections[ENROLLMENTS].count; i++) {
+        tables.enrollments.push_back({enrollments[i].studentId, enrollments[i].courseId});
+    }
+    tables.grades.reserve(header.sections[GRADES].count);
+    for (uint64_t i = 0; i < header.sections[GRADES].count; i++) {
+        const GradeRecord& g = grades[i];
+        tables.grades.push_back({g.studentId, g.courseId, g.score, textAt(g.note), g.teacherId});
+    }
+    serverMetrics().snapshotTextBytes.store(textSection.bytes, memory_order_relaxed);
+    return true;
+}
+
+//   JSON form section - data.json, kept for importing and exporting the tables
+
+//   converter from a user to its JSON form, ids resolved through names and text through text
+json userToJson(const User& u, const UserDetails& details, const StringPool& text, const deque<string>& names) {
+    json user;
+    user["id"] = names[u.id];
+    user["username"] = text.view(u.username);
+    user["password"] = text.view(details.password);
+    user["role"] = text.view(details.roleName);
+    user["firstName"] = text.view(details.firstName);
+    user["lastName"] = text.view(details.lastName);
+    user["dateOfBirth"] = text.view(details.dateOfBirth);
+    user["email"] = text.view(details.email);
+    user["name"] = text.view(u.name);
+    return user;
+}
+
+//   converter from the JSON form of a user into its two parts, its id already interned and its text interned
+//   into text
+void userFromJson(const json& u, IdHandle id, StringPool& text, User& user, UserDetails& details) {
+    string role = u.value("role", "");
+    user.id = id;
+    user.role = roleFromName(role);
+    user.username = text.intern(u.value("username", ""));
+    user.name = text.intern(u.value("name", ""));
+    details.password = text.intern(u.value("password", ""));
+    details.roleName = text.intern(role);
+    details.firstName = text.intern(u.value("firstName", ""));
+    details.lastName = text.intern(u.value("lastName", ""));
+    details.dateOfBirth = text.intern(u.value("dateOfBirth", ""));
+    details.email = text.intern(u.value("email", ""));
+}
+
+//   converter from the tables to the JSON document form
+json snapshotToJson(const SnapshotTables& tables) {
+    const deque<string>& names = tables.idNames;
+    const StringPool& text = *tables.text;
+    json data;
+    data["walSegment"] = tables.walSegment;
+
+    //   saver for users
+    data["users"] = json::array();
+    for (size_t i = 0; i < tables.users.size(); i++) {
+        data["users"].push_back(userToJson(tables.users[i], tables.userDetails[i], text, names));
+    }
+
+    //   saver for courses
+    data["courses"] = json::array();
+    for (auto& c : tables.courses) {
+        json course;
+        course["id"] = names[c.id];
+        course["name"] = text.view(c.name);
+        course["teacherId"] = names[c.teacherId];
+        course["description"] = text.view(c.description);
+        data["courses"].push_back(course);
+    }
+
+    //   saver for enrollments
+    data["enrollments"] = json::array();
+    for (auto& e : tables.enrollments) {
+        json enrollment;
+        enrollment["studentId"] = names[e.studentId];
+        enrollment["courseId"] = names[e.courseId];
+        data["enrollments"].push_back(enrollment);
+    }
+
+    //   saver for grades
+    data["grades"] = json::array();
+    for (auto& g : tables.grades) {
+        json grade;
+        grade["studentId"] = names[g.studentId];
+        grade["courseId"] = names[g.courseId];
+        grade["score"] = g.score;
+        grade["note"] = text.view(g.note);
+        grade["teacherId"] = names[g.teacherId];
+        data["grades"].push_back(grade);
+    }
+    return data;
+}
+
+//   SAX handler filling the tables while data.json is parsed, so only the row being read exists beyond the
+//   tables themselves; unknown fields, values of the wrong type and anything nested inside a row are skipped
+class JsonSnapshotReader : public nlohmann::json_sax<json> {
+public:
+    JsonSnapshotReader(SnapshotTables& tables, function<void(uint64_t rows)> progress)
+        : tables(tables), progress(move(progress)) {}
+
+    bool null() override { return true; }
+    bool boolean(bool) override { return true; }
+    bool number_integer(number_integer_t value) override { return number(value); }
+    bool number_unsigned(number_unsigned_t value) override { return number(value); }
+    bool number_float(number_float_t value, const string_t&) override { return number(value); }
+    bool binary(binary_t&) override { return true; }
+
+    bool string(string_t& value) override {
+        if (depth != ROW_DEPTH || table == NONE) return true;
+        if (std::string* id = rowId()) {
+            *id = move(value);
+        } else if (TextHandle* target = rowText()) {
+            *target = tables.text->intern(value);
+        }
+        return true;
+    }
+
+    bool key(string_t& name) override {
+        if (depth == TOP_DEPTH || depth == ROW_DEPTH) {
+            field = move(name);
+        }
+        return true;
+    }
+
+    bool start_object(size_t) override {
+        depth++;
+        if (depth == ROW_DEPTH && table != NONE) {
+            user = User();
+            details = UserDetails();
+            course = Course();
+            grade = Grade();
+            for (auto& id : ids) id.clear();
+        }
+        return true;
+    }
+
+    bool end_object() override {
+        if (depth == ROW_DEPTH && table != NONE) {
+            finishRow();
+        }
+        depth--;
+        return true;
+    }
+
+    bool start_array(size_t) override {
+        depth++;
+        if (depth == TABLE_DEPTH) {
+            table = field == "users" ? USERS : field == "courses" ? COURSES
+                  : field == "enrollments" ? ENROLLMENTS : field == "grades" ? GRADES : NONE;
+        }
+        return true;
+    }
+
+    bool end_array() override {
+        if (depth == TABLE_DEPTH) {
+            table = NONE;
+        }
+        depth--;
+        return true;
+    }
+
+    bool parse_error(size_t position, const std::string&, const nlohmann::detail::exception& error) override {
+        message = "parse error at byte " + to_string(position) + ": " + error.what();
+        return false;
+    }
+
+    std::string message;
+
+private:
+    enum Table { NONE, USERS, COURSES, ENROLLMENTS, GRADES };
+
+    //   nesting of the document object, a table's array and one of its rows
+    static const size_t TOP_DEPTH = 1;
+    static const size_t TABLE_DEPTH = 2;
+    static const size_t ROW_DEPTH = 3;
+
+    // setter for the numeric fields, converted the way json::value() converts them
+    template <typename T>
+    bool number(T value) {
+        if (depth == TOP_DEPTH && field == "walSegment") {
+            tables.walSegment = (uint64_t)value;
+        } else if (depth == ROW_DEPTH && table == GRADES && field == "score") {
+            grade.score = (int)value;
+        }
+        return true;
+    }
+
+    // id field of the current row named field, nullptr if the table has none
+    std::string* rowId() {
+        switch (table) {
+        case USERS:
+            if (field == "id") return &ids[0];
+            return nullptr;
+        case COURSES:
+            if (field == "id") return &ids[0];
+            if (field == "teacherId") return &ids[1];
+            return nullptr;
+        case ENROLLMENTS:
+            if (field == "studentId") return &ids[0];
+            if (field == "courseId") return &ids[1];
+            return nullptr;
+        case GRADES:
+            if (field == "studentId") return &ids[0];
+            if (field == "courseId") return &ids[1];
+            if (field == "teacherId") return &ids[2];
+            return nullptr;
+        default:
+            return nullptr;
+        }
+    }
+
+    // text field of the current row named field, nullptr if the table has none
+    TextHandle* rowText() {
+        switch (table) {
+        case USERS:
+            if (field == "username") return &user.username;
+            if (field == "password") return &details.password;
+            if (field == "role") return &details.roleName;
+            if (field == "name") return &user.name;
+            if (field == "firstName") return &details.firstName;
+            if (field == "lastName") return &details.lastName;
+            if (field == "dateOfBirth") return &details.dateOfBirth;
+            if (field == "email") return &details.email;
+            return nullptr;
+        case COURSES:
+            if (field == "name") return &course.name;
+            if (field == "description") return &course.description;
+            return nullptr;
+        case GRADES:
+            if (field == "note") return &grade.note;
+            return nullptr;
+        default:
+            return nullptr;
+        }
+    }
+
+    // appender for the finished row, its ids interned in field order whatever order the file had them in
+    void finishRow() {
+        switch (table) {
+        case USERS:
+            user.id = intern(ids[0]);
+            user.role = roleFromName(tables.text->view(details.roleName));
+            tables.users.push_back(user);
+            tables.userDetails.push_back(details);
+            break;
+        case COURSES:
+            course.id = intern(ids[0]);
+            course.teacherId = intern(ids[1]);
+            tables.courses.push_back(course);
+            break;
+        case ENROLLMENTS:
+            tables.enrollments.push_back({intern(ids[0]), intern(ids[1])});
+            break;
+        case GRADES:
+            grade.studentId = intern(ids[0]);
+            grade.courseId = intern(ids[1]);
+            grade.teacherId = intern(ids[2]);
+            tables.grades.push_back(grade);
+            break;
+        default:
+            return;
+        }
+        if (++rows % PROGRESS_ROWS == 0) {
+            progress(rows);
+        }
+    }
+
+    // handle for an id, interned on first appearance
+    IdHandle intern(const std::string& id) {
+        auto it = handles.find(id);
+        if (it != handles.end()) {
+            return it->second;
+        }
+        IdHandle handle = tables.idNames.size();
+        tables.idNames.push_back(id);
+        handles.emplace(tables.idNames.back(), handle);
+        return handle;
+    }
+
+    //   rows between progress callbacks
+    static const uint64_t PROGRESS_ROWS = 4096;
+
+    SnapshotTables& tables;
+    function<void(uint64_t rows)> progress;
+    unordered_map<string_view, IdHandle> handles;
+    size_t depth = 0;
+    Table table = NONE;
+    std::string field;
+    uint64_t rows = 0;
+
+    //   row being read; ids are kept as text until the row ends
+    User user;
+    UserDetails details;
+    Course course;
+    Grade grade;
+    std::string ids[3];
+};
+
+//   reader for data.json through the SAX parser, reporting every tenth of the file read
+bool readJsonSnapshot(const string& path, SnapshotTables& tables, string& error) {
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) {
+        error = errno == ENOENT ? "" : strerror(errno);
+        return false;
+    }
+    file.seekg(0, ios::end);
+    streamoff total = file.tellg();
+    file.seekg(0, ios::beg);
+
+    tables = SnapshotTables();
+    tables.text = make_shared<StringPool>();
+    int reported = 0;
+    JsonSnapshotReader reader(tables, [&](uint64_t rows) {
+        int percent = total > 0 ? (int)(file.tellg() * 100 / total) : 100;
+        if (percent / 10 > reported / 10) {
+            reported = percent;
+            cout << "Loading " << path << ": " << percent << "% (" << rows << " rows)" << endl;
+        }
+    });
+    if (!json::sax_parse(file, &reader)) {
+        error = reader.message.empty() ? "unreadable" : reader.message;
+        return false;
+    }
+    return true;
+}
+
+//   writer for a whole file that either fully replaces path or leaves it untouched: temp file, fsync, rename,
+//   then fsync of the directory so the rename itself survives a crash; false if any step failed, errno from it
+bool writeFileAtomically(const string& path, const vector<string_view>& pieces) {
+    string tempPath = path + ".tmp";
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    for (string_view piece : pieces) {
+        const char* data = piece.data();
+        size_t left = piece.size();
+        while (left > 0) {
+            ssize_t written = write(fd, data, left);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                close(fd);
+                unlink(tempPath.c_str());
+                return false;
+            }
+            data += written;
+            left -= written;
+        }
+    }
+    //   the descriptor is closed whether or not the fsync worked, and either failing abandons the temp file
+    bool synced = fsync(fd) == 0;
+    int syncError = errno;
+    bool closed = close(fd) == 0;
+    if (!synced || !closed || rename(tempPath.c_str(), path.c_str()) < 0) {
+        int error = synced ? errno : syncError;
+        unlink(tempPath.c_str());
+        errno = error;
+        return false;
+    }
+
+    //   until the directory entry is on disk a crash can bring back the old file, which callers must not assume
+    //   is gone (the log segments it needs are only deleted once this returns true)
+    size_t slash = path.rfind('/');
+    string directory = slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int dirFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) {
+        return false;
+    }
+    synced = fsync(dirFd) == 0;
+    syncError = errno;
+    close(dirFd);
+    errno = syncError;
+    return synced;
+}
@@ -0,0 +1,66 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include "json.hpp"
+#include <memory>
+#include "models.h"
+#include "stringpool.h"
+
+using json = nlohmann::json;
+using namespace std;
+
+//   snapshot section - the DataStore tables as one file, in a binary form that is memory-mapped at startup and
+//   in the JSON form data.json used to import and export them
+
+//   binary layout (version 1, little-endian, every section 8-byte aligned):
+//     header      magic "SMSSNAP\0", version, walSegment, then per section its offset, byte length, element count
+//                 and CRC-32, then the CRC-32 of the header itself
+//     strings     u64 offsets (count + 1 of them) into the text section; string i is text[offsets[i], offsets[i+1])
+//     text        string bytes, each distinct value stored once
+//     users, courses, enrollments, grades
+//                 fixed-width records whose text fields are u32 indices into the string table; ids are the first
+//                 idCount strings, so a stored id is also its IdHandle
+
+//   copy of every table, taken under the writer locks and serialized after they are released; the records' text
+//   handles refer to text, which the readers below create and a saved copy shares with the DataStore
+struct SnapshotTables {
+    vector<User> users;
+    vector<UserDetails> userDetails;   // cold part of users[i] at i
+    vector<Course> courses;
+    vector<Enrollment> enrollments;
+    vector<Grade> grades;
+    deque<string> idNames;     // string form by IdHandle
+    shared_ptr<StringPool> text;
+    uint64_t walSegment = 0;   // first write-ahead log segment the snapshot does not cover
+};
+
+// writer for a binary snapshot, replacing path atomically; false (errno set) if it could not be written
+bool writeBinarySnapshot(const string& path, const SnapshotTables& tables);
+
+// reader for a binary snapshot through a read-only mapping; false if it is missing, of another version or fails a
+// check, with the reason in error (empty if the file does not exist)
+bool readBinarySnapshot(const string& path, SnapshotTables& tables, string& error);
+
+// converter from the tables to the JSON document form
+json snapshotToJson(const SnapshotTables& tables);
+
+// reader for the JSON form through a streaming (SAX) parser that fills the tables as it goes, printing progress
+// for large files; false if it is missing or malformed, with the reason in error (empty if it does not exist)
+bool readJsonSnapshot(const string& path, SnapshotTables& tables, string& error);
+
+// converter from a user's two parts to its JSON form, ids resolved through names and text through text
+json userToJson(const User& u, const UserDetails& details, const StringPool& text, const deque<string>& names);
+
+// converter from the JSON form of a user into its two parts, its id already interned by the caller and its text
+// interned into text
+void userFromJson(const json& u, IdHandle id, StringPool& text, User& user, UserDetails& details);
+
+// writer for a whole file, the pieces in order, that either fully replaces path or leaves it untouched
+bool writeFileAtomically(const string& path, const vector<string_view>& pieces);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,91 @@
+#include "stringpool.h"
+#include <functional>
+#include <stdexcept>
+#include "metrics.h"
+
+StringPool::StringPool() {
+    for (auto& chunk : chunks) {
+        chunk.store(nullptr, memory_order_relaxed);
+    }
+    index.assign(1024, {NO_TEXT, 0});
+    intern("");
+}
+
+StringPool::~StringPool() {
+    serverMetrics().textBytes.fetch_sub(stored, memory_order_relaxed);
+}
+
+//   handle for a value, looked up in the dedup index and appended on a miss
+TextHandle StringPool::intern(string_view value) {
+    uint32_t hash = std::hash<string_view>()(value);
+    lock_guard<mutex> lock(writer);
+    size_t mask = index.size() - 1;
+    for (size_t slot = hash & mask; index[slot].handle != NO_TEXT; slot = (slot + 1) & mask) {
+        if (index[slot].hash == hash && view(index[slot].handle) == value) {
+            return index[slot].handle;
+        }
+    }
+    
+    //   the index stays at most half full so probe runs stay short
+    if ((distinct + 1) * 2 > index.size()) {
+        resizeIndex(index.size() * 2);
+    }
+    TextHandle handle = append(value);
+    indexSlot({handle, hash});
+    distinct++;
+    return handle;
+}
+
+//   appender for a value known to be new, left out of the dedup index
+TextHandle StringPool::add(string_view value) {
+    lock_guard<mutex> lock(writer);
+    return append(value);
+}
+
+//   inserter for an entry into the dedup index
+void StringPool::indexSlot(IndexSlot entry) {
+    size_t mask = index.size() - 1;
+    size_t slot = entry.hash & mask;
+    while (index[slot].handle != NO_TEXT) {
+        slot = (slot + 1) & mask;
+    }
+    index[slot] = entry;
+}
+
+//   resizer for the dedup index, entries reinserted by their kept hash
+void StringPool::resizeIndex(size_t slots) {
+    vector<IndexSlot> old(slots, {NO_TEXT, 0});
+    old.swap(index);
+    for (const IndexSlot& entry : old) {
+        if (entry.handle != NO_TEXT) {
+            indexSlot(entry);
+        }
+    }
+}
+
+//   appender for a new value at the write position, opening a chunk when it does not fit the current one
+TextHandle StringPool::append(string_view value) {
+    size_t entryBytes = sizeof(uint32_t) + value.size();
+    if (used + entryBytes > CHUNK_BYTES) {
+        //   a value larger than a chunk gets a buffer of its own, taking as many chunk positions as it spans
+        size_t span = (entryBytes + CHUNK_BYTES - 1) / CHUNK_BYTES;
+        if (nextChunk + span > MAX_CHUNKS) {
+            throw length_error("string pool is full");
+        }
+        owned.emplace_back(new char[span * CHUNK_BYTES]);
+        currentChunk = nextChunk;
+        chunks[currentChunk].store(owned.back().get(), memory_order_release);
+        nextChunk += span;
+        used = 0;
+    }
+    
+    char* entry = owned.back().get() + used;
+    uint32_t length = value.size();
+    memcpy(entry, &length, sizeof(length));
+    memcpy(entry + sizeof(length), value.data(), value.size());
+    TextHandle handle = currentChunk << CHUNK_SHIFT | used;
+    used += entryBytes;
+    stored += entryBytes;
+    serverMetrics().textBytes.fetch_add(entryBytes, memory_order_relaxed);
+    return handle;
+}
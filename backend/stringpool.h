@@ -0,0 +1,88 @@
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cstring>
+#include "models.h"
+
+using namespace std;
+
+//   string pool section - the text of every record, stored once per distinct value and referenced by TextHandle
+
+//   values are appended back to back into 1 MiB chunks as a u32 length and the bytes; a handle is the byte
+//   position of its value, so resolving one is a shift, a mask and one load with no lock and no hashing. Chunks
+//   never move or shrink, which lets any thread read a value while another one interns: a reader only ever
+//   holds handles that were published to it (through a left-right flip or a lock) after their bytes were written
+//
+//   nothing is freed; a value no record refers to any more (an overwritten grade note) stays until the next
+//   startup, which reads the snapshot back into a fresh pool holding only the values in use. Handles span 4 GiB,
+//   so a server that rewrites text for long enough without a restart fills the pool and intern() throws
+//   length_error; the textBytes and snapshotTextBytes metrics show how much of the pool is still in use
+class StringPool {
+public:
+    StringPool();
+    ~StringPool();
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    // handle for a value, appended on first use; writers may call it concurrently
+    TextHandle intern(string_view value);
+
+    // appender for a value known to be new, skipping the dedup index; for a snapshot's strings, which are distinct
+    // already. A later intern() of the same value does not find it and stores it once more
+    TextHandle add(string_view value);
+
+    // value of a handle returned by intern() or add(), valid for the life of the pool
+    string_view view(TextHandle handle) const {
+        const char* entry = chunks[handle >> CHUNK_SHIFT].load(memory_order_acquire) + (handle & (CHUNK_BYTES - 1));
+        uint32_t length;
+        memcpy(&length, entry, sizeof(length));
+        return string_view(entry + sizeof(length), length);
+    }
+
+private:
+    static constexpr int CHUNK_SHIFT = 20;
+    static constexpr size_t CHUNK_BYTES = size_t(1) << CHUNK_SHIFT;
+
+    //   chunk table sized for the whole 32-bit handle space, so it never has to grow under a reader
+    static constexpr size_t MAX_CHUNKS = (size_t(1) << 32) >> CHUNK_SHIFT;
+
+    //   empty slot of the dedup index
+    static constexpr TextHandle NO_TEXT = UINT32_MAX;
+
+    // appender for a value not in the pool yet, returning its handle
+    TextHandle append(string_view value);
+
+    //   dedup index entry, the value's hash kept beside its handle so probing past other values never touches
+    //   their bytes
+    struct IndexSlot {
+        TextHandle handle;
+        uint32_t hash;
+    };
+
+    // inserter for an entry into the dedup index, at the first free slot of its probe sequence
+    void indexSlot(IndexSlot entry);
+
+    // resizer for the dedup index to slots entries (a power of two), reinserting what it holds
+    void resizeIndex(size_t slots);
+
+    atomic<const char*> chunks[MAX_CHUNKS];
+
+    //   writer side, under writer: the chunks owned, the write position, and an open-addressing dedup index of
+    //   handles probed by the hash of their value
+    mutex writer;
+    vector<unique_ptr<char[]>> owned;
+    size_t currentChunk = 0;
+    size_t nextChunk = 0;
+    size_t used = CHUNK_BYTES;
+    vector<IndexSlot> index;
+    size_t distinct = 0;
+    uint64_t stored = 0;       // bytes of every value appended, counted in the textBytes metric until destruction
+};
+
+#endif // STRINGPOOL_H
@@ -0,0 +1,105 @@
+#include "timerwheel.h"
+
+//   largest distance in ticks a timer can be placed ahead of the current tick
+static const uint64_t WHEEL_SPAN = (uint64_t)1 << (TimerWheel::SLOT_BITS * TimerWheel::LEVELS);
+
+TimerWheel::TimerWheel(chrono::milliseconds tick, chrono::steady_clock::time_point start)
+    : tick(tick.count() > 0 ? tick : chrono::milliseconds(1)), origin(start) {
+    for (auto& level : slots) {
+        for (auto& head : level) {
+            head.prev = head.next = &head;
+        }
+    }
+}
+
+//   converter from a time point to the first tick at or after it
+uint64_t TimerWheel::tickAt(chrono::steady_clock::time_point when) const {
+    if (when <= origin) return 0;
+    auto elapsed = chrono::ceil<chrono::milliseconds>(when - origin).count();
+    return (elapsed + tick.count() - 1) / tick.count();
+}
+
+//   scheduler (or rescheduler) for timer to fire at the first tick at or after deadline
+void TimerWheel::schedule(WheelTimer& timer, chrono::steady_clock::time_point deadline) {
+    cancel(timer);
+
+    //   the current tick's slot was already expired, so the earliest a new timer can fire is the next one
+    uint64_t expiry = tickAt(deadline);
+    if (expiry <= currentTick) expiry = currentTick + 1;
+    if (expiry - currentTick >= WHEEL_SPAN) expiry = currentTick + WHEEL_SPAN - 1;
+
+    timer.expiry = expiry;
+    insert(timer);
+    activeTimers++;
+}
+
+//   canceller for a scheduled timer, a no-op for one that is not scheduled
+void TimerWheel::cancel(WheelTimer& timer) {
+    if (!timer.scheduled()) return;
+    timer.prev->next = timer.next;
+    timer.next->prev = timer.prev;
+    timer.prev = timer.next = nullptr;
+    activeTimers--;
+}
+
+//   linker for timer into the slot for its expiry relative to the current tick
+void TimerWheel::insert(WheelTimer& timer) {
+    //   level l holds timers less than SLOTS^(l+1) ticks away, indexed by bits l*SLOT_BITS.. of the expiry
+    uint64_t distance = timer.expiry > currentTick ? timer.expiry - currentTick : 0;
+    int level = 0;
+    while (level < LEVELS - 1 && distance >= ((uint64_t)1 << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+
+    WheelTimer& head = slots[level][(timer.expiry >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    timer.prev = head.prev;
+    timer.next = &head;
+    head.prev->next = &timer;
+    head.prev = &timer;
+}
+
+//   re-inserter for every timer of a higher-level slot into the levels below
+void TimerWheel::cascade(int level, uint64_t slot) {
+    WheelTimer& head = slots[level][slot];
+    WheelTimer* timer = head.next;
+    head.prev = head.next = &head;
+
+    while (timer != &head) {
+        WheelTimer* next = timer->next;
+        insert(*timer);
+        timer = next;
+    }
+}
+
+//   advancer of the wheel up to now, appending the key of every timer that came due to expired
+void TimerWheel::advance(chrono::steady_clock::time_point now, vector<uint64_t>& expired) {
+    //   only ticks that have fully begun are processed, so a timer never fires before its deadline
+    uint64_t target = 0;
+    if (now > origin) {
+        target = chrono::duration_cast<chrono::milliseconds>(now - origin).count() / tick.count();
+    }
+
+    while (currentTick < target) {
+        //   nothing to expire or cascade, so the wheel can jump straight to the target
+        if (activeTimers == 0) {
+            currentTick = target;
+            return;
+        }
+
+        currentTick++;
+
+        //   higher levels are cascaded top-down whenever the level below wraps around
+        for (int level = LEVELS - 1; level >= 1; level--) {
+            if ((currentTick & (((uint64_t)1 << (SLOT_BITS * level)) - 1)) == 0) {
+                cascade(level, (currentTick >> (SLOT_BITS * level)) & (SLOTS - 1));
+            }
+        }
+
+        WheelTimer& head = slots[0][currentTick & (SLOTS - 1)];
+        while (head.next != &head) {
+            WheelTimer* timer = head.next;
+            cancel(*timer);
+            expired.push_back(timer->key);
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+//   timer wheel section - hierarchical hashed timing wheel giving O(1) schedule, cancel and expiry
+//   for the per-connection deadlines of one event loop
+
+//   intrusive timer, embedded in whatever it times so scheduling never allocates
+struct WheelTimer {
+    uint64_t key = 0;               // caller's identifier, handed back when the timer fires
+    uint64_t expiry = 0;            // absolute tick the timer fires at
+    WheelTimer* prev = nullptr;     // slot list links, null while not scheduled
+    WheelTimer* next = nullptr;
+
+    // checker whether the timer is currently scheduled
+    bool scheduled() const { return prev != nullptr; }
+};
+
+class TimerWheel {
+public:
+    //   slots per level and number of levels; with 100 ms ticks the levels span 6.4 s, 6.8 min and 7.3 h
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int LEVELS = 3;
+
+    TimerWheel(chrono::milliseconds tick, chrono::steady_clock::time_point start);
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // scheduler (or rescheduler) for timer to fire at the first tick at or after deadline; deadlines past the
+    // wheel's span fire early at the end of the span, callers re-check and reschedule
+    void schedule(WheelTimer& timer, chrono::steady_clock::time_point deadline);
+
+    // canceller for a scheduled timer, a no-op for one that is not scheduled
+    void cancel(WheelTimer& timer);
+
+    // advancer of the wheel up to now, appending the key of every timer that came due to expired
+    void advance(chrono::steady_clock::time_point now, vector<uint64_t>& expired);
+
+    // checker whether no timer is scheduled
+    bool empty() const { return activeTimers == 0; }
+
+    // length of one tick, the resolution deadlines are rounded up to
+    chrono::milliseconds tickLength() const { return tick; }
+
+private:
+    // converter from a time point to the first tick at or after it
+    uint64_t tickAt(chrono::steady_clock::time_point when) const;
+
+    // linker for timer into the slot for its expiry relative to the current tick
+    void insert(WheelTimer& timer);
+
+    // re-inserter for every timer of a higher-level slot into the levels below
+    void cascade(int level, uint64_t slot);
+
+    chrono::milliseconds tick;
+    chrono::steady_clock::time_point origin;
+    uint64_t currentTick = 0;
+    size_t activeTimers = 0;
+    WheelTimer slots[LEVELS][SLOTS];    // list heads, each a circular list through prev/next
+};
+
+#endif // TIMERWHEEL_H
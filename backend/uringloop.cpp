@@ -0,0 +1,598 @@
+#include "uringloop.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+//   submission queue depth, the completion queue is twice this
+static const unsigned RING_ENTRIES = 4096;
+
+//   provided recv buffers per worker (must be a power of two) and the size of each
+static const unsigned BUF_COUNT = 256;
+static const size_t BUF_SIZE = 16384;
+
+//   buffer group id the recv buffers are registered under
+static const unsigned short BUF_GROUP = 0;
+
+//   packer and unpackers for the operation kind and connection id carried in user_data
+static uint64_t packUserData(uint64_t op, uint32_t id) {
+    return (op << 56) | id;
+}
+
+static uint64_t opOf(uint64_t userData) {
+    return userData >> 56;
+}
+
+static uint32_t idOf(uint64_t userData) {
+    return (uint32_t)userData;
+}
+
+//   thin wrappers for the io_uring syscalls (no liburing dependency)
+static int ioUringSetup(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+static int ioUringRegister(int fd, unsigned opcode, void* arg, unsigned nrArgs) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+//   checker whether the kernel offers every io_uring feature this backend needs
+bool UringLoop::supported() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = ioUringSetup(8, &params);
+    if (fd < 0) {
+        return false;
+    }
+
+    //   provided buffer rings arrived in 5.19 together with multishot accept
+    size_t size = sizeof(struct io_uring_buf) * 8;
+    void* ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool ok = false;
+    if (ring != MAP_FAILED) {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)ring;
+        reg.ring_entries = 8;
+        reg.bgid = BUF_GROUP;
+        ok = ioUringRegister(fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+        munmap(ring, size);
+    }
+    close(fd);
+    return ok;
+}
+
+UringLoop::UringLoop(DataStore& store, int listenFd, const ServerConfig& config, AdmissionControl& admission)
+    : store(store), config(config), admission(admission), listenSocket(listenFd), timers(CONNECTION_TIMER_TICK, chrono::steady_clock::now()) {
+    timerTick.tv_nsec = chrono::duration_cast<chrono::nanoseconds>(CONNECTION_TIMER_TICK).count();
+    if (!setupRing() || !setupBufferRing()) {
+        cerr << "Error setting up io_uring" << endl;
+        return;
+    }
+
+    //   left blocking: io_uring parks the read until the flusher signals instead of failing it with EAGAIN
+    commitFd = eventfd(0, EFD_CLOEXEC);
+    if (commitFd < 0) {
+        cerr << "Error creating eventfd" << endl;
+        return;
+    }
+    store.watchLog(commitFd);
+}
+
+UringLoop::~UringLoop() {
+    for (auto& entry : connections) {
+        close(entry.second.conn->fd());
+    }
+    if (commitFd >= 0) {
+        store.unwatchLog(commitFd);
+        close(commitFd);
+    }
+    if (bufRing != nullptr) munmap(bufRing, bufRingSize);
+    if (sqes != nullptr) munmap(sqes, sqesSize);
+    if (cqRingPtr != nullptr && cqRingPtr != sqRingPtr) munmap(cqRingPtr, cqRingSize);
+    if (sqRingPtr != nullptr) munmap(sqRingPtr, sqRingSize);
+    if (ringFd >= 0) close(ringFd);
+}
+
+//   setter-up for the submission/completion rings
+bool UringLoop::setupRing() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = ioUringSetup(RING_ENTRIES, &params);
+    if (ringFd < 0) {
+        return false;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+        sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+    }
+
+    sqRingPtr = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRingPtr == MAP_FAILED) {
+        sqRingPtr = nullptr;
+        return false;
+    }
+    cqRingPtr = singleMmap ? sqRingPtr
+                           : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    if (cqRingPtr == MAP_FAILED) {
+        cqRingPtr = nullptr;
+        return false;
+    }
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqesPtr = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqesPtr == MAP_FAILED) {
+        return false;
+    }
+    sqes = (struct io_uring_sqe*)sqesPtr;
+
+    char* sq = (char*)sqRingPtr;
+    sqHead = (unsigned*)(sq + params.sq_off.head);
+    sqTail = (unsigned*)(sq + params.sq_off.tail);
+    sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    sqEntries = *(unsigned*)(sq + params.sq_off.ring_entries);
+    sqArray = (unsigned*)(sq + params.sq_off.array);
+    sqLocalTail = *sqTail;
+
+    char* cq = (char*)cqRingPtr;
+    cqHead = (unsigned*)(cq + params.cq_off.head);
+    cqTail = (unsigned*)(cq + params.cq_off.tail);
+    cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+//   setter-up for the provided receive buffer ring
+bool UringLoop::setupBufferRing() {
+    if (ringFd < 0) {
+        return false;
+    }
+
+    bufRingSize = sizeof(struct io_uring_buf) * BUF_COUNT;
+    void* ring = mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)ring;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if (ioUringRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        munmap(ring, bufRingSize);
+        return false;
+    }
+
+    bufRing = (struct io_uring_buf_ring*)ring;
+    bufferPool.resize(BUF_COUNT * BUF_SIZE);
+    for (unsigned i = 0; i < BUF_COUNT; i++) {
+        recycleBuffer((uint16_t)i);
+    }
+    return true;
+}
+
+//   returner for a provided buffer to the buffer ring
+void UringLoop::recycleBuffer(uint16_t bufferId) {
+    //   indexed by hand: in C++ the header's flexible-array wrapper shifts bufs[] by 8 bytes
+    struct io_uring_buf* buf = (struct io_uring_buf*)bufRing + (bufLocalTail & (BUF_COUNT - 1));
+    buf->addr = (uint64_t)(bufferPool.data() + bufferId * BUF_SIZE);
+    buf->len = BUF_SIZE;
+    buf->bid = bufferId;
+    bufLocalTail++;
+    __atomic_store_n(&bufRing->tail, bufLocalTail, __ATOMIC_RELEASE);
+}
+
+//   next free submission entry, flushing the queue to the kernel when it is full
+struct io_uring_sqe* UringLoop::nextSqe() {
+    while (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+        if (!submit(false)) break;
+    }
+    unsigned index = sqLocalTail & sqMask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    sqLocalTail++;
+    sqPending++;
+    return sqe;
+}
+
+//   submitter for queued entries, optionally waiting for at least one completion
+bool UringLoop::submit(bool wait) {
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    while (true) {
+        int submitted = ioUringEnter(ringFd, sqPending, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (submitted >= 0) {
+            sqPending -= (unsigned)submitted;
+            return true;
+        }
+        if (errno == EINTR) continue;
+        //   completion queue is backed up, reap before submitting more
+        if (errno == EBUSY || errno == EAGAIN) return true;
+        cerr << "Error entering io_uring: " << strerror(errno) << endl;
+        return false;
+    }
+}
+
+//   submitters for each operation
+void UringLoop::armAccept() {
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenSocket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = packUserData(OP_ACCEPT, 0);
+}
+
+void UringLoop::armRecv(uint32_t id, int fd) {
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->ioprio = multishotRecv ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = packUserData(OP_RECV, id);
+}
+
+void UringLoop::armTimeout() {
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)&timerTick;
+    sqe->len = 1;
+    sqe->user_data = packUserData(OP_TIMEOUT, 0);
+    timeoutArmed = true;
+}
+
+void UringLoop::armCommitRead() {
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = commitFd;
+    sqe->addr = (uint64_t)&commitSignals;
+    sqe->len = sizeof(commitSignals);
+    sqe->user_data = packUserData(OP_COMMIT, 0);
+}
+
+void UringLoop::submitSend(uint32_t id, ConnEntry& entry) {
+    Connection& conn = *entry.conn;
+    int count = conn.gatherOutput(entry.iov, MAX_IOVECS);
+    size_t gathered = 0;
+    for (int i = 0; i < count; i++) {
+        gathered += entry.iov[i].iov_len;
+    }
+    entry.msg = {};
+    entry.msg.msg_iov = entry.iov;
+    entry.msg.msg_iovlen = count;
+
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn.fd();
+    sqe->addr = (uint64_t)&entry.msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = packUserData(OP_SEND, id);
+    entry.sendInFlight = true;
+
+    //   the last response on a connection carries its own shutdown and close in the same submission
+    if (conn.closesAfterFlush() && gathered == conn.pendingOutputSize() && !conn.streamingOutput()) {
+        sqe->msg_flags |= MSG_WAITALL;
+        sqe->flags |= IOSQE_IO_HARDLINK;
+        entry.closeLinked = true;
+        submitClose(conn.fd());
+    }
+}
+
+void UringLoop::submitClose(int fd) {
+    //   shutdown first so the connection's outstanding multishot recv completes
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = fd;
+    sqe->len = SHUT_RDWR;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe->user_data = packUserData(OP_CLOSE, 0);
+
+    sqe = nextSqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = packUserData(OP_CLOSE, 0);
+}
+
+void UringLoop::submitShed(int fd) {
+    //   the pre-rendered 503 outlives the send, so it goes out straight from admission control's buffer
+    string_view response = admission.overloadResponse();
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)response.data();
+    sqe->len = response.size();
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe->user_data = packUserData(OP_CLOSE, 0);
+    submitClose(fd);
+}
+
+void UringLoop::submitCancel(Op op, uint32_t id) {
+    //   matched by user_data rather than fd, a send with a linked close may already have released the fd
+    struct io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = packUserData(op, id);
+    sqe->user_data = packUserData(OP_CANCEL, 0);
+}
+
+//   runner for the loop, returns only on a fatal io_uring error
+void UringLoop::run() {
+    if (!ready()) {
+        return;
+    }
+    armAccept();
+    armCommitRead();
+
+    while (true) {
+        if (!submit(true)) {
+            return;
+        }
+
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe cqe = cqes[head & cqMask];
+            head++;
+            //   release the slot before handling so completions queued meanwhile have room
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            handleCompletion(cqe);
+        }
+        releaseCommitted();
+        submitQueuedSends();
+    }
+}
+
+//   dispatchers for one completion of each kind
+void UringLoop::handleCompletion(const struct io_uring_cqe& cqe) {
+    switch (opOf(cqe.user_data)) {
+        case OP_ACCEPT:
+            onAccept(cqe);
+            break;
+        case OP_RECV:
+            onRecv(idOf(cqe.user_data), cqe);
+            break;
+        case OP_SEND:
+            onSend(idOf(cqe.user_data), cqe);
+            break;
+        case OP_TIMEOUT:
+            timeoutArmed = false;
+            reapExpiredConnections();
+            if (!timers.empty()) armTimeout();
+            break;
+        case OP_COMMIT:
+            //   held connections are released by releaseCommitted() once this batch of completions is handled
+            armCommitRead();
+            break;
+        default:
+            break;
+    }
+}
+
+void UringLoop::onAccept(const struct io_uring_cqe& cqe) {
+    if (cqe.res >= 0 && !admission.admit()) {
+        submitShed(cqe.res);
+    } else if (cqe.res >= 0) {
+        uint32_t id = nextConnectionId++;
+        if (nextConnectionId == 0) nextConnectionId = 1;
+        ConnEntry& entry = connections[id];
+        entry.conn = make_unique<Connection>(cqe.res, config.maxRequestsPerConnection, config.maxBodyBytes);
+        entry.conn->timer().key = id;
+        updateDeadline(entry);
+        armRecv(id, cqe.res);
+        entry.recvArmed = true;
+    } else if (cqe.res != -EAGAIN && cqe.res != -EINTR) {
+        cerr << "Error accepting connection" << endl;
+    }
+
+    //   multishot accept stays armed until the kernel says otherwise
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        armAccept();
+    }
+}
+
+void UringLoop::onRecv(uint32_t id, const struct io_uring_cqe& cqe) {
+    bool hasBuffer = cqe.flags & IORING_CQE_F_BUFFER;
+    uint16_t bufferId = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+
+    auto it = connections.find(id);
+    if (it == connections.end()) {
+        //   late completion for a connection already closed
+        if (hasBuffer) recycleBuffer(bufferId);
+        return;
+    }
+    ConnEntry& entry = it->second;
+    Connection& conn = *entry.conn;
+
+    if (cqe.res > 0 && hasBuffer) {
+        conn.appendInput(bufferPool.data() + bufferId * BUF_SIZE, cqe.res);
+        recycleBuffer(bufferId);
+    } else if (cqe.res == 0) {
+        conn.markPeerClosed();
+    } else if (cqe.res == -EINVAL && multishotRecv) {
+        //   kernels before 6.0 reject multishot recv, fall back to re-arming after every completion
+        multishotRecv = false;
+    } else if (cqe.res != -ENOBUFS && cqe.res != -EAGAIN && cqe.res != -EINTR && cqe.res != -ECANCELED) {
+        conn.markClosing();
+    }
+
+    //   a recv that ended is re-armed by advance() if the connection still takes input
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        entry.recvArmed = false;
+        entry.recvCancelled = false;
+    }
+    advance(id, entry);
+}
+
+void UringLoop::onSend(uint32_t id, const struct io_uring_cqe& cqe) {
+    auto it = connections.find(id);
+    if (it == connections.end()) {
+        return;
+    }
+    ConnEntry& entry = it->second;
+    entry.sendInFlight = false;
+
+    //   the kernel already shut down and closed the socket after this send
+    if (entry.closeLinked) {
+        timers.cancel(entry.conn->timer());
+        connections.erase(it);
+        admission.release();
+        return;
+    }
+
+    if (cqe.res > 0) {
+        entry.conn->consumeOutput(cqe.res);
+    } else if (cqe.res != -EAGAIN && cqe.res != -EINTR) {
+        entry.conn->markClosing();
+    }
+    advance(id, entry);
+}
+
+//   processor for buffered input and the send it may need, closing when the connection is done
+void UringLoop::advance(uint32_t id, ConnEntry& entry) {
+    Connection& conn = *entry.conn;
+
+    //   the output buffer must not move while the kernel is reading from it
+    if (!entry.sendInFlight) {
+        conn.processInput(store);
+        if (conn.pendingOutputSize() > 0 && conn.state() != Connection::CLOSING) {
+            //   acknowledgements of mutations wait until the flusher has the group commit they ride on durable
+            if (conn.awaitingLog()) {
+                awaitingCommit.push_back(id);
+            } else if (!entry.sendQueued) {
+                //   sent once the whole batch is handled: nothing reaches the kernel sooner, and an EOF in the same
+                //   batch still switches the last response to Connection: close
+                entry.sendQueued = true;
+                sendQueue.push_back(id);
+            }
+        }
+    }
+    if (conn.state() == Connection::CLOSING) {
+        closeConnection(id);
+        return;
+    }
+    updateRecv(id, entry);
+    updateDeadline(entry);
+}
+
+//   pauser and resumer of reading: a connection that stops taking input has its recv cancelled, so a client that
+//   pipelines without reading is no longer read once its responses back up and the rest stays in the socket; the
+//   recv is armed again once they drain
+void UringLoop::updateRecv(uint32_t id, ConnEntry& entry) {
+    bool wanted = entry.conn->wantsInput();
+    if (wanted && !entry.recvArmed) {
+        armRecv(id, entry.conn->fd());
+        entry.recvArmed = true;
+    } else if (!wanted && entry.recvArmed && !entry.recvCancelled) {
+        submitCancel(OP_RECV, id);
+        entry.recvCancelled = true;
+    }
+}
+
+//   submitter for queued sends, skipping connections that closed or were held for the log since
+void UringLoop::submitQueuedSends() {
+    for (uint32_t id : sendQueue) {
+        auto it = connections.find(id);
+        if (it == connections.end()) continue;
+        ConnEntry& entry = it->second;
+        entry.sendQueued = false;
+        Connection& conn = *entry.conn;
+        if (entry.sendInFlight || conn.state() == Connection::CLOSING || conn.pendingOutputSize() == 0 || conn.awaitingLog()) {
+            continue;
+        }
+        submitSend(id, entry);
+    }
+    sendQueue.clear();
+}
+
+//   sender for output held for the write-ahead log: every held connection whose records the flusher has reached
+//   gets its send submitted, the rest stay held until the read on commitFd completes again; pipelined requests
+//   answered meanwhile may hold a connection again
+void UringLoop::releaseCommitted() {
+    if (awaitingCommit.empty()) return;
+    WriteAheadLog::Progress progress = store.logProgress();
+
+    //   a connection held again by several completions of one batch is listed once
+    sort(awaitingCommit.begin(), awaitingCommit.end());
+    awaitingCommit.erase(unique(awaitingCommit.begin(), awaitingCommit.end()), awaitingCommit.end());
+
+    releasing.swap(awaitingCommit);
+    for (uint32_t id : releasing) {
+        auto it = connections.find(id);
+        if (it == connections.end()) continue;
+        it->second.conn->commitReached(progress);
+        advance(id, it->second);
+    }
+    releasing.clear();
+}
+
+//   closer for a connection, shutting it down so its pending recv completes
+void UringLoop::closeConnection(uint32_t id) {
+    auto it = connections.find(id);
+    if (it == connections.end()) {
+        return;
+    }
+    ConnEntry& entry = it->second;
+    timers.cancel(entry.conn->timer());
+
+    //   a send the client is not reading would never complete, so it is cancelled and the close
+    //   happens from its completion
+    if (entry.sendInFlight) {
+        entry.conn->markClosing();
+        submitCancel(OP_SEND, id);
+        return;
+    }
+    submitClose(entry.conn->fd());
+    connections.erase(it);
+    admission.release();
+}
+
+//   rescheduler for the connection's timer on its current deadline, arming the tick timeout if needed
+void UringLoop::updateDeadline(ConnEntry& entry) {
+    Connection::Deadline deadline = entry.conn->deadline(config);
+    if (!deadline.armed) {
+        timers.cancel(entry.conn->timer());
+        return;
+    }
+    timers.schedule(entry.conn->timer(), deadline.at);
+    if (!timeoutArmed) {
+        armTimeout();
+    }
+}
+
+//   closer for every connection whose deadline passed, counting each by reason
+void UringLoop::reapExpiredConnections() {
+    auto now = chrono::steady_clock::now();
+    expired.clear();
+    timers.advance(now, expired);
+
+    for (uint64_t key : expired) {
+        auto it = connections.find((uint32_t)key);
+        if (it == connections.end()) continue;
+
+        //   deadlines beyond the wheel's span fire early and are simply put back
+        Connection::Deadline deadline = it->second.conn->deadline(config);
+        if (!deadline.armed) continue;
+        if (deadline.at > now) {
+            timers.schedule(it->second.conn->timer(), deadline.at);
+            continue;
+        }
+        countMetric(serverMetrics().connectionsReaped[deadline.reason]);
+        closeConnection((uint32_t)key);
+    }
+}
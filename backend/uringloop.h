@@ -0,0 +1,162 @@
+#ifndef URINGLOOP_H
+#define URINGLOOP_H
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/socket.h>
+#include "connection.h"
+#include "datastore.h"
+#include "config.h"
+#include "admission.h"
+#include "timerwheel.h"
+
+using namespace std;
+
+//   io_uring event loop section - completion-based alternative to the epoll reactor, batching
+//   accept/recv/send/close submissions into one io_uring_enter() call per loop iteration
+
+class UringLoop {
+public:
+    UringLoop(DataStore& store, int listenFd, const ServerConfig& config, AdmissionControl& admission);
+    ~UringLoop();
+
+    // checker whether the kernel offers every io_uring feature this backend needs
+    static bool supported();
+
+    // checker whether the ring and buffer ring were set up
+    bool ready() const { return ringFd >= 0 && bufRing != nullptr; }
+
+    // runner for the loop, returns only on a fatal io_uring error
+    void run();
+
+private:
+    //   operation kind carried in the top byte of every submission's user_data
+    enum Op : uint64_t {
+        OP_ACCEPT = 1,
+        OP_RECV,
+        OP_SEND,
+        OP_CLOSE,
+        OP_TIMEOUT,
+        OP_CANCEL,
+        OP_COMMIT
+    };
+
+    //   iovecs gathered per sendmsg submission (16 pipelined responses)
+    static const int MAX_IOVECS = 16 * HTTP_RESPONSE_SEGMENTS;
+
+    struct ConnEntry {
+        unique_ptr<Connection> conn;
+        bool sendInFlight = false;
+        bool sendQueued = false;                // listed in sendQueue
+        bool recvArmed = false;                 // until a recv completion without IORING_CQE_F_MORE
+        bool recvCancelled = false;             // cancel submitted for the armed recv
+        bool closeLinked = false;
+        struct msghdr msg = {};                 // must stay put while the kernel owns the send
+        struct iovec iov[MAX_IOVECS];
+    };
+
+    // setter-up for the submission/completion rings
+    bool setupRing();
+
+    // setter-up for the provided receive buffer ring
+    bool setupBufferRing();
+
+    // next free submission entry, flushing the queue to the kernel when it is full
+    struct io_uring_sqe* nextSqe();
+
+    // submitter for queued entries, optionally waiting for at least one completion
+    bool submit(bool wait);
+
+    // submitters for each operation
+    void armAccept();
+    void armRecv(uint32_t id, int fd);
+    void armTimeout();
+    void armCommitRead();
+    void submitSend(uint32_t id, ConnEntry& entry);
+    void submitClose(int fd);
+    void submitCancel(Op op, uint32_t id);
+    void submitShed(int fd);
+
+    // dispatchers for one completion of each kind
+    void handleCompletion(const struct io_uring_cqe& cqe);
+    void onAccept(const struct io_uring_cqe& cqe);
+    void onRecv(uint32_t id, const struct io_uring_cqe& cqe);
+    void onSend(uint32_t id, const struct io_uring_cqe& cqe);
+
+    // returner for a provided buffer to the buffer ring
+    void recycleBuffer(uint16_t bufferId);
+
+    // processor for buffered input and the send it may need, closing when the connection is done
+    void advance(uint32_t id, ConnEntry& entry);
+
+    // pauser and resumer of reading, following whether the connection takes more input
+    void updateRecv(uint32_t id, ConnEntry& entry);
+
+    // closer for a connection, shutting it down so its pending recv completes
+    void closeConnection(uint32_t id);
+
+    // rescheduler for the connection's timer on its current deadline, arming the tick timeout if needed
+    void updateDeadline(ConnEntry& entry);
+
+    // closer for every connection whose deadline passed, counting each by reason
+    void reapExpiredConnections();
+
+    // submitter for the send of every connection advance() queued one for during this batch of completions
+    void submitQueuedSends();
+
+    // sender for output held for the write-ahead log whose records the flusher has reached, never waits for it
+    void releaseCommitted();
+
+    DataStore& store;
+    const ServerConfig& config;
+    AdmissionControl& admission;
+    int listenSocket;
+    int ringFd = -1;
+
+    //   submission ring
+    void* sqRingPtr = nullptr;
+    size_t sqRingSize = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned* sqArray = nullptr;
+    struct io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned sqLocalTail = 0;
+    unsigned sqPending = 0;
+
+    //   completion ring
+    void* cqRingPtr = nullptr;
+    size_t cqRingSize = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    struct io_uring_cqe* cqes = nullptr;
+
+    //   provided buffer ring for recv
+    struct io_uring_buf_ring* bufRing = nullptr;
+    size_t bufRingSize = 0;
+    unsigned short bufLocalTail = 0;
+    vector<char> bufferPool;
+
+    bool multishotRecv = true;
+    uint32_t nextConnectionId = 1;
+    unordered_map<uint32_t, ConnEntry> connections;
+
+    //   connection deadlines, the tick timeout is only kept armed while a timer is scheduled
+    TimerWheel timers;
+    vector<uint64_t> expired;
+    struct __kernel_timespec timerTick = {};
+    bool timeoutArmed = false;
+    int commitFd = -1;                  // eventfd the log flusher signals on progress, always read by one submission
+    uint64_t commitSignals = 0;         // target of that read
+    vector<uint32_t> awaitingCommit;    // connections whose output waits for the log, checked once per batch
+    vector<uint32_t> releasing;         // reused by releaseCommitted()
+    vector<uint32_t> sendQueue;         // connections with output to send once this batch of completions is handled
+};
+
+#endif // URINGLOOP_H
@@ -0,0 +1,384 @@
+#include "wal.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include "metrics.h"
+
+//   size of the length and CRC fields in front of every payload
+static const size_t RECORD_HEADER = 8;
+
+//   CRC-32 (IEEE, reflected) of a byte range, eight bytes per step through eight derived tables (slicing-by-8)
+uint32_t crc32(string_view data) {
+    static uint32_t table[8][256];
+    static bool built = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int t = 1; t < 8; t++) {
+                table[t][i] = table[0][table[t - 1][i] & 0xFF] ^ (table[t - 1][i] >> 8);
+            }
+        }
+        return true;
+    }();
+    (void)built;
+
+    uint32_t crc = 0xFFFFFFFFu;
+    const unsigned char* bytes = (const unsigned char*)data.data();
+    size_t length = data.size();
+    while (length >= 8) {
+        uint32_t low, high;
+        memcpy(&low, bytes, 4);
+        memcpy(&high, bytes + 4, 4);
+        low ^= crc;
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^
+              table[4][low >> 24] ^ table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^
+              table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+        bytes += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = table[0][(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+//   writer for every byte of buffer, retrying short writes and interrupts
+static bool writeAll(int fd, const char* buffer, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, buffer, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buffer += written;
+        length -= written;
+    }
+    return true;
+}
+
+WriteAheadLog::WriteAheadLog(string path, bool sync, chrono::microseconds batchWindow, size_t maxBatch)
+    : path(move(path)), sync(sync), batchWindow(batchWindow), maxBatch(maxBatch > 0 ? maxBatch : 1) {}
+
+//   destructor that lets the flusher drain the queue before the file is closed
+WriteAheadLog::~WriteAheadLog() {
+    {
+        lock_guard<mutex> lock(queueLock);
+        stopping = true;
+    }
+    queued.notify_one();
+    if (flusher.joinable()) {
+        flusher.join();
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+//   file name of a segment
+string WriteAheadLog::segmentPath(uint64_t segment) const {
+    return path + "." + to_string(segment);
+}
+
+//   numbers of the segments on disk, ascending
+vector<uint64_t> WriteAheadLog::listSegments() const {
+    size_t slash = path.rfind('/');
+    string directory = slash == string::npos ? "." : path.substr(0, slash);
+    string prefix = (slash == string::npos ? path : path.substr(slash + 1)) + ".";
+
+    vector<uint64_t> segments;
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) return segments;
+    while (struct dirent* entry = readdir(dir)) {
+        string_view name = entry->d_name;
+        if (name.size() <= prefix.size() || name.substr(0, prefix.size()) != prefix) continue;
+        string_view digits = name.substr(prefix.size());
+        if (digits.find_first_not_of("0123456789") != string_view::npos) continue;
+        segments.push_back(stoull(string(digits)));
+    }
+    closedir(dir);
+    sort(segments.begin(), segments.end());
+    return segments;
+}
+
+//   replayer for every intact record of one segment file, truncating its torn tail; returns the intact bytes
+static uint64_t replaySegment(const string& file, const function<void(string_view payload)>& apply,
+                              size_t& records) {
+    int segmentFd = open(file.c_str(), O_RDWR | O_CLOEXEC);
+    if (segmentFd < 0) {
+        cerr << "Error opening write-ahead log " << file << ": " << strerror(errno) << endl;
+        return 0;
+    }
+
+    string contents;
+    char chunk[65536];
+    while (true) {
+        ssize_t got = read(segmentFd, chunk, sizeof(chunk));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        contents.append(chunk, got);
+    }
+
+    size_t offset = 0;
+    while (contents.size() - offset >= RECORD_HEADER) {
+        uint32_t length, crc;
+        memcpy(&length, contents.data() + offset, 4);
+        memcpy(&crc, contents.data() + offset + 4, 4);
+        if (contents.size() - offset - RECORD_HEADER < length) break;
+
+        string_view payload(contents.data() + offset + RECORD_HEADER, length);
+        if (crc32(payload) != crc) break;
+
+        apply(payload);
+        offset += RECORD_HEADER + length;
+        records++;
+    }
+
+    //   anything past the last intact record is an append that never completed, drop it so new records follow it
+    if (offset < contents.size()) {
+        cerr << "Write-ahead log " << file << ": discarding " << (contents.size() - offset)
+             << " bytes of torn tail" << endl;
+        if (ftruncate(segmentFd, offset) < 0) {
+            cerr << "Error truncating write-ahead log: " << strerror(errno) << endl;
+        }
+    }
+    close(segmentFd);
+    return offset;
+}
+
+//   opener that drops covered segments, replays the rest and appends to the newest
+size_t WriteAheadLog::open(uint64_t firstSegment, const function<void(string_view payload)>& apply) {
+    removeBefore(firstSegment);
+
+    size_t records = 0;
+    uint64_t replayedBytes = 0;
+    segment = firstSegment > 0 ? firstSegment : 1;
+    for (uint64_t existing : listSegments()) {
+        segmentBytes = replaySegment(segmentPath(existing), apply, records);
+        replayedBytes += segmentBytes;
+        segment = existing;
+    }
+
+    fd = ::open(segmentPath(segment).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        cerr << "Error opening write-ahead log " << segmentPath(segment) << ": " << strerror(errno) << endl;
+        failed = true;
+    }
+    bytes = replayedBytes;
+    flusher = thread(&WriteAheadLog::runFlusher, this);
+    return records;
+}
+
+//   parser for a durability name as used by the X-Durability header and the DURABILITY settings
+bool WriteAheadLog::parseDurability(string_view name, Durability& level) {
+    if (name == "none") {
+        level = QUEUED;
+    } else if (name == "write") {
+        level = WRITTEN;
+    } else if (name == "fsync") {
+        level = SYNCED;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+//   queuer for one record, the flusher is woken for the first record of a batch and for the one that fills it
+uint64_t WriteAheadLog::append(string_view payload) {
+    uint32_t length = payload.size();
+    uint32_t crc = crc32(payload);
+
+    lock_guard<mutex> lock(queueLock);
+    pending.append((const char*)&length, 4);
+    pending.append((const char*)&crc, 4);
+    pending.append(payload);
+    pendingRecords++;
+    bytes += RECORD_HEADER + payload.size();
+    if (pendingRecords == 1 || pendingRecords == maxBatch) {
+        queued.notify_one();
+    }
+    return ++appendedSequence;
+}
+
+//   snapshot of how far the flusher got
+WriteAheadLog::Progress WriteAheadLog::progress() {
+    lock_guard<mutex> lock(queueLock);
+    return Progress{writtenSequence, syncedSequence, failed.load(memory_order_relaxed)};
+}
+
+//   registrar for an eventfd signalled on progress
+void WriteAheadLog::watch(int eventFd) {
+    lock_guard<mutex> lock(queueLock);
+    watchers.push_back(eventFd);
+}
+
+void WriteAheadLog::unwatch(int eventFd) {
+    lock_guard<mutex> lock(queueLock);
+    watchers.erase(remove(watchers.begin(), watchers.end(), eventFd), watchers.end());
+}
+
+//   publisher of new sequences; the eventfds are signalled after the sequences are stored, so a loop that reads
+//   its eventfd and then calls progress() never misses a batch
+void WriteAheadLog::publish(uint64_t written, uint64_t synced) {
+    writtenSequence = written;
+    syncedSequence = synced;
+    for (int watcher : watchers) {
+        eventfd_write(watcher, 1);
+    }
+}
+
+//   marker for a broken log; progress is republished unchanged so the loops see the failure
+void WriteAheadLog::fail() {
+    lock_guard<mutex> lock(queueLock);
+    failed = true;
+    publish(writtenSequence, syncedSequence);
+}
+
+//   writer of everything queued; a cut is completed by whichever of the flusher and rotate() gets here first, so
+//   no record after it is ever written to the segment it closes
+void WriteAheadLog::writeQueued() {
+    string batch;
+    size_t records;
+    uint64_t last;
+    uint64_t restoredBytes = 0;
+    bool switching;
+    {
+        lock_guard<mutex> lock(queueLock);
+        switching = cutPending;
+        if (switching) {
+            cutPending = false;
+            batch.swap(cutBatch);
+            records = cutRecords;
+            last = cutSequence;
+            restoredBytes = cutBytes;
+        }
+    }
+    if (switching) {
+        writeBatch(batch, records, last);
+        switchSegment(restoredBytes);
+        batch.clear();
+    }
+
+    {
+        lock_guard<mutex> lock(queueLock);
+        batch.swap(pending);
+        records = pendingRecords;
+        pendingRecords = 0;
+        last = appendedSequence;
+    }
+    writeBatch(batch, records, last);
+}
+
+//   writer of one batch, header and payload of every record in a single write so a crash tears at most the
+//   batch's tail; the batch is published as written before its fdatasync and as synced after it. A failure
+//   breaks the log instead, the batch is never reported durable
+void WriteAheadLog::writeBatch(const string& batch, size_t records, uint64_t last) {
+    //   a broken log is never written again, the dropped records would leave a gap
+    if (failed) return;
+
+    if (records > 0) {
+        if (!writeAll(fd, batch.data(), batch.size())) {
+            cerr << "Error appending to write-ahead log: " << strerror(errno) << endl;
+            //   cut off whatever part of the batch made it, or a restart would replay it as intact records
+            if (ftruncate(fd, segmentBytes) < 0) {
+                cerr << "Error truncating write-ahead log: " << strerror(errno) << endl;
+            }
+            fail();
+            return;
+        }
+        segmentBytes += batch.size();
+        countMetric(serverMetrics().walBatches);
+        serverMetrics().walRecords.fetch_add(records, memory_order_relaxed);
+
+        if (sync) {
+            {
+                lock_guard<mutex> lock(queueLock);
+                publish(last, syncedSequence);
+            }
+            if (fdatasync(fd) < 0) {
+                cerr << "Error syncing write-ahead log: " << strerror(errno) << endl;
+                fail();
+                return;
+            }
+        }
+    }
+
+    lock_guard<mutex> lock(queueLock);
+    publish(last, last);
+}
+
+//   flusher loop: sleep until a record is queued, linger up to batchWindow for the batch to fill, write it
+void WriteAheadLog::runFlusher() {
+    unique_lock<mutex> lock(queueLock);
+    while (true) {
+        queued.wait(lock, [this] { return stopping || pendingRecords > 0; });
+        if (pendingRecords == 0) break;
+        if (batchWindow.count() > 0) {
+            queued.wait_for(lock, batchWindow, [this] { return stopping || pendingRecords >= maxBatch; });
+        }
+
+        //   lock order is ioLock before queueLock, so the queue is released while the batch is written
+        lock.unlock();
+        {
+            lock_guard<mutex> io(ioLock);
+            writeQueued();
+        }
+        lock.lock();
+    }
+}
+
+//   marker for the end of the current segment; the records queued so far are set aside for it, and size() starts
+//   over from the records after them
+uint64_t WriteAheadLog::cut() {
+    lock_guard<mutex> lock(queueLock);
+    cutPending = true;
+    cutBatch.swap(pending);
+    cutRecords = pendingRecords;
+    pendingRecords = 0;
+    cutSequence = appendedSequence;
+    cutBytes = bytes.exchange(0);
+    return segment + 1;
+}
+
+//   switcher to the segment after the last cut; the flusher may already have completed it
+uint64_t WriteAheadLog::rotate() {
+    lock_guard<mutex> io(ioLock);
+    writeQueued();
+    return rotatedTo;
+}
+
+//   opener of the segment after the current one; on failure appends stay in the current segment, which then
+//   also holds records after the cut, so the snapshot that asked for it must not be kept
+void WriteAheadLog::switchSegment(uint64_t cutBytes) {
+    int next = ::open(segmentPath(segment + 1).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (next < 0) {
+        cerr << "Error creating write-ahead log segment: " << strerror(errno) << endl;
+        bytes += cutBytes;
+        rotatedTo = 0;
+        return;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = next;
+    segment++;
+    segmentBytes = 0;
+    rotatedTo = segment;
+}
+
+//   deleter for every segment before firstSegment
+void WriteAheadLog::removeBefore(uint64_t firstSegment) const {
+    for (uint64_t existing : listSegments()) {
+        if (existing >= firstSegment) break;
+        unlink(segmentPath(existing).c_str());
+    }
+}
@@ -0,0 +1,156 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+
+using namespace std;
+
+// CRC-32 (IEEE) of a byte range, framing log records and snapshot sections
+uint32_t crc32(string_view data);
+
+//   write-ahead log section - append-only files of mutation records replayed on top of the last snapshot
+
+//   the log is a run of numbered segment files (<path>.1, <path>.2, ...); appends go to the newest, and a snapshot
+//   cuts the log where its tables stand and rotates to a fresh segment there, so every older segment can be
+//   deleted once the snapshot is on disk. The cut is a queue operation, the writes and the switch happen later
+//
+//   appends are group-committed: append() only queues the record and returns its sequence number, a flusher
+//   thread writes everything queued with one write() and one fdatasync(); writers that queue while a batch is
+//   being synced all ride the next one. Nobody blocks on the flusher: it signals every watching eventfd whenever
+//   it publishes progress, and the event loops compare progress() against the records their responses wait for
+//
+//   a batch is reported written (in the page cache, survives a crash of the process) before its fdatasync starts
+//   and synced (survives power loss) after it, so callers that only need the first are not held by the disk
+//
+//   a failed open, write or fdatasync breaks the log for good: progress stops where it was, the batch and every
+//   record queued after it are dropped (writing them behind a lost one would make replay skip it), and
+//   progress() reports the failure so their acknowledgements are answered with an error instead
+//
+//   on-disk record: payload length (u32), CRC-32 of the payload (u32), payload bytes; a record that is
+//   cut short or fails its CRC ends its segment, it is the tail of an append that never completed
+class WriteAheadLog {
+public:
+    //   how far a record must get before the response acknowledging it goes out
+    enum Durability {
+        QUEUED,     // fire-and-forget, only in the in-memory queue
+        WRITTEN,    // handed to the kernel with write()
+        SYNCED      // on disk after fdatasync (same as WRITTEN when sync is off)
+    };
+
+    //   sync: fdatasync every batch; batchWindow: how long the flusher lingers for more records once the first
+    //   is queued; maxBatch: records that close a batch early
+    WriteAheadLog(string path, bool sync, chrono::microseconds batchWindow, size_t maxBatch);
+    ~WriteAheadLog();
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // opener that deletes segments before firstSegment, replays every intact record of the rest in order
+    // (truncating torn tails), appends to the newest and starts the flusher; returns how many records were replayed
+    size_t open(uint64_t firstSegment, const function<void(string_view payload)>& apply);
+
+    // parser for a durability name: "none", "write" or "fsync"; false if it is none of them
+    static bool parseDurability(string_view name, Durability& level);
+
+    // queuer for one record, returns its sequence number to compare against progress()
+    uint64_t append(string_view payload);
+
+    //   sequences every record up to which has been written and synced
+    struct Progress {
+        uint64_t written;
+        uint64_t synced;
+        bool failed;        // the log broke, records past written or synced will never get there
+    };
+
+    // snapshot of how far the flusher got, never blocks
+    Progress progress();
+
+    // checker whether the log broke, readable from any thread; no mutation should be accepted from then on
+    bool broken() const { return failed.load(memory_order_relaxed); }
+
+    // registrar for an eventfd the flusher adds 1 to each time progress() moves; unwatch before closing it
+    void watch(int eventFd);
+    void unwatch(int eventFd);
+
+    // marker for the end of the current segment: records queued so far belong to it, later ones to the next.
+    // Never touches the disk, so it can run while appends are held off; returns the next segment's number
+    uint64_t cut();
+
+    // switcher to the segment after the last cut() once the records before it are written (and synced), returns
+    // the new segment's number or 0 if it could not be created (the log is unchanged, the cut is dropped)
+    uint64_t rotate();
+
+    // deleter for every segment before firstSegment, once a snapshot covers them
+    void removeBefore(uint64_t firstSegment) const;
+
+    // bytes appended since the last cut, readable from any thread
+    uint64_t size() const { return bytes.load(memory_order_relaxed); }
+
+private:
+    // file name of a segment
+    string segmentPath(uint64_t segment) const;
+
+    // numbers of the segments on disk, ascending
+    vector<uint64_t> listSegments() const;
+
+    // writer of everything queued, the records before a pending cut first as their own batch followed by the
+    // switch to the next segment; caller holds ioLock
+    void writeQueued();
+
+    // writer of one batch of records up to sequence last, caller holds ioLock
+    void writeBatch(const string& batch, size_t records, uint64_t last);
+
+    // opener of the segment after the current one for the cut just written, caller holds ioLock
+    void switchSegment(uint64_t cutBytes);
+
+    // publisher of new written and synced sequences to every watcher, caller holds queueLock
+    void publish(uint64_t written, uint64_t synced);
+
+    // marker for a broken log, published to every watcher
+    void fail();
+
+    // flusher loop, one batch per wakeup until the log is destroyed and the queue is empty
+    void runFlusher();
+
+    string path;
+    bool sync;
+    chrono::microseconds batchWindow;
+    size_t maxBatch;
+
+    //   file state, owned by whoever holds ioLock (the flusher, or rotate())
+    mutex ioLock;
+    int fd = -1;
+    uint64_t segment = 0;
+    uint64_t segmentBytes = 0;     // intact bytes in the current segment, where a failed write is cut back to
+    uint64_t rotatedTo = 0;        // segment the last cut switched to, 0 if it could not be created
+
+    //   queue state, guarded by queueLock; lock order is ioLock before queueLock
+    mutex queueLock;
+    condition_variable queued;     // signalled to the flusher when a batch can start or close
+    string pending;                // encoded records not yet written
+    size_t pendingRecords = 0;
+    uint64_t appendedSequence = 0;
+    uint64_t writtenSequence = 0;
+    uint64_t syncedSequence = 0;
+    bool cutPending = false;       // records before the cut are waiting in cutBatch for writeQueued()
+    string cutBatch;
+    size_t cutRecords = 0;
+    uint64_t cutSequence = 0;
+    uint64_t cutBytes = 0;         // size() at the cut, given back if the switch fails
+    vector<int> watchers;          // eventfds signalled by publish()
+    bool stopping = false;
+    thread flusher;
+
+    atomic<bool> failed{false};
+    atomic<uint64_t> bytes{0};
+};
+
+#endif // WAL_H